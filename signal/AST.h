@@ -629,7 +629,8 @@ namespace Signal
 			PLUS, 
 			MINUS, 
 			TIMES, 
-			DIVIDE
+			DIVIDE,
+			MODULO
 		};
 
 		class ASTBinaryMathOp (OpType type, std::shared_ptr<ASTExpression> left, std::shared_ptr<ASTExpression> right)
@@ -667,6 +668,52 @@ namespace Signal
 		std::shared_ptr<ASTExpression> m_right;
 	};
 
+	// var op= expr, e.g. x += 1
+	class ASTCompoundAssignment : public ASTExpression
+	{
+		public:
+
+		ASTCompoundAssignment (ASTBinaryMathOp::OpType type, std::string& var, std::shared_ptr<ASTExpression> expr)
+		:
+			m_type (type),
+			m_expr (expr)
+		{
+			m_var.swap (var);
+		}
+
+		ASTExpression::Type type () const
+		{
+			return ASTExpression::ASSIGNMENT;
+		}
+
+		const std::string& var () const
+		{
+			return m_var;
+		}
+
+		std::shared_ptr<ASTExpression> expr () const
+		{
+			return m_expr;
+		}
+
+		ASTBinaryMathOp::OpType op_type () const
+		{
+			return m_type;
+		}
+
+		void accept (VisitorInterface& visitor, std::shared_ptr<Function> func) const
+		{
+			visitor.visit (*this, func);
+		}
+
+		private:
+
+		ASTBinaryMathOp::OpType m_type;
+
+		std::string m_var;
+		std::shared_ptr<ASTExpression> m_expr;
+	};
+
 	class ASTUnaryMathOp : public ASTExpression
 	{
 		public:
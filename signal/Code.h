@@ -1,11 +1,16 @@
 #pragma once
 
+#include <cmath>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "Types.h"
 
 namespace Signal
 {
+	class Class;
+	class Function;
 	class Object;
 	class Scope;
 
@@ -13,69 +18,119 @@ namespace Signal
 	{
 		OP_PUSH,	// Push object onto top of stack
 		OP_POP,		// Pop object back from top of stack
+		OP_DUP,		// Push the object on top of the stack again
 		OP_NIL,		// Push Nil onto stack
+		OP_NEW,		// Push a new instance of the class of the prototype instance in object
 
-		OP_CALL,	// Call a function
-		OP_MCALL,	// Call a member function
+		OP_CALL,	// Call the global function with index arg
+		OP_TAILCALL,	// Call the global function with index arg in place of the current one (return f (...))
+		OP_MCALL,	// Call a member function on the receiver below its arg arguments, arg2 is the call site's cache
 		OP_RETURN,	// Return from a function call, a return value is on top of the stack
-		OP_ECALL,	// Call exported function
+		OP_ECALL,	// Call the exported function with index arg on the top arg2 objects of the stack
 
-		OP_SET,		// Sets variable to object on top of the stack
-		OP_DEF,     // Defines a variable and sets it to object on top of the stack
-		OP_REF,		// References a variable to the stack
+		OP_LOAD_MEMBER,		// Push the member variable named by object of the frame's instance
+		OP_STORE_MEMBER,	// Sets the member variable named by object of the frame's instance to object on top of the stack
+
+		OP_LOAD_LOCAL,	// Push the local in frame slot arg onto the stack
+		OP_STORE_LOCAL,	// Sets the local in frame slot arg to object on top of the stack
+
+		OP_UPDATE_MEMBER,	// Applies the operator arg2 to the member variable named by object and the object on top of the stack, stores the answer and replaces the top with it (for x += y)
+		OP_UPDATE_LOCAL,	// Applies the operator arg2 to the local in frame slot arg and the object on top of the stack, stores the answer and replaces the top with it
 
 		OP_BR,		// Branch unconditionally
 		OP_BRT,		// If top of the stack has True then branch
 		OP_BRF,		// If top of the stack has False then branch
+		OP_BRT_OR_POP,	// If top of the stack has True then branch and keep it, pop False and throw on anything else (for ||)
+		OP_BRF_OR_POP,	// If top of the stack has False then branch and keep it, pop True and throw on anything else (for &&)
+
+		OP_SWITCH,	// Pop a number or string and branch to its case in the switch table arg, other objects carry on
+
+		OP_FORPREP,	// Enter a counted for loop, pops the bound, step and inclusive flag into a loop slot
+		OP_FORLOOP,	// Step the counter of a counted for loop and branch back while it is in range
 
 		OP_ADD,		// Add two objects from top of stack, and push the answer to the stack
 		OP_SUB,		// Subtract two objects from top of stack, and push the answer to the stack
 		OP_MUL,		// Multiply two objects from top of stack, and push the answer to the stack
 		OP_DIV,		// Divide two objects from top of stack, and push the answer to the stack
+		OP_MOD,		// Divide two objects from top of stack, and push the remainder to the stack
 		OP_NEG,		// Negate the top of the stack
 
 		OP_INC,		// Increment the object on top of the stack
 		OP_DEC,		// Decrement the object on top of the stack
 
 		OP_NOT,		// Logical not the top of the stack
-		OP_OR,		// Or two objects from top of stack, and push the answer to the stack
-		OP_AND,		// And two objects from top of stack, and push the answer to the stack
 		OP_EQEQ,	// Compare two objects from top of stack, and push the boolean answer to the stack
 		OP_NEQ,		// Compare two objects from top of stack, and push the boolean answer to the stack
 		OP_LT,		// Compare two objects from top of stack, and push the boolean answer to the stack
 		OP_GT,		// Compare two objects from top of stack, and push the boolean answer to the stack
 		OP_LTE,		// Compare two objects from top of stack, and push the boolean answer to the stack
-		OP_GTE		// Compare two objects from top of stack, and push the boolean answer to the stack
+		OP_GTE,		// Compare two objects from top of stack, and push the boolean answer to the stack
+
+		// Number-only forms of the operators above. In hot functions the interpreter swaps the generic
+		// instruction for these once it has seen two numbers, and back when that guess fails. The swap is
+		// made in the interpreter's own copy of the opcodes, the code itself is never changed.
+		OP_QADD,
+		OP_QSUB,
+		OP_QMUL,
+		OP_QDIV,
+		OP_QEQEQ,
+		OP_QNEQ,
+		OP_QLT,
+		OP_QGT,
+		OP_QLTE,
+		OP_QGTE,
+
+		// Number-only forms the compiler emits where it has proven both operands are numbers, they don't
+		// check their operands at all. See Compiler::specialize.
+		OP_NADD,
+		OP_NSUB,
+		OP_NMUL,
+		OP_NDIV,
+		OP_NEQEQ,
+		OP_NNEQ,
+		OP_NLT,
+		OP_NGT,
+		OP_NLTE,
+		OP_NGTE
 	};
 
 	struct Instruction
 	{
 		Instruction (OpCode op)
 		:
-			m_op (op)
+			m_op   (op),
+			m_arg  (0),
+			m_arg2 (0)
 		{}
 
 		Instruction (OpCode op, uint32_t arg)
 		:
-			m_op  (op),
-			m_arg (arg)
+			m_op   (op),
+			m_arg  (arg),
+			m_arg2 (0)
 		{}
 
 		Instruction (OpCode op, std::shared_ptr<Object> object)
 		:
 			m_op	 (op),
+			m_arg	 (0),
+			m_arg2	 (0),
 			m_object (object)
 		{}
 
 		Instruction (OpCode op, std::shared_ptr<Scope> scope)
 		:
 			m_op	(op),
+			m_arg	(0),
+			m_arg2	(0),
 			m_scope (scope)
 		{}
 
 		Instruction (OpCode op, std::shared_ptr<Scope> scope, std::shared_ptr<Object> object)
 		:
 			m_op	 (op),
+			m_arg	 (0),
+			m_arg2	 (0),
 			m_scope  (scope),
 			m_object (object)
 		{}
@@ -84,16 +139,101 @@ namespace Signal
 		:
 			m_op	 (op),
 			m_arg	 (arg),
+			m_arg2	 (0),
+			m_object (object)
+		{}
+
+		Instruction (OpCode op, uint32_t arg, uint32_t arg2, std::shared_ptr<Object> object)
+		:
+			m_op	 (op),
+			m_arg	 (arg),
+			m_arg2	 (arg2),
 			m_object (object)
 		{}
 
 		OpCode   m_op;
 		uint32_t m_arg;
+		uint32_t m_arg2;
 
 		std::shared_ptr<Scope>  m_scope;
 		std::shared_ptr<Object> m_object;
 	};
 
+	// Remembers which function a member call site dispatched to for the last few receiver classes. Each
+	// interpreter keeps its own caches, see Interpreter::Profile.
+	#define INLINE_CACHE_ENTRIES	4
+
+	struct InlineCache
+	{
+		InlineCache (uint32_t selector)
+		:
+			m_selector (selector),
+			m_size	   (0)
+		{}
+
+		struct Entry
+		{
+			const Class*			  m_class;
+			std::shared_ptr<Function> m_func;
+		};
+
+		uint32_t m_selector;	// Which function the site calls, see Environment::selector
+
+		Entry	 m_entries[INLINE_CACHE_ENTRIES];
+		uint32_t m_size;
+	};
+
+	// A switch over at least this many number or string literal cases is dispatched with a table
+	#define SWITCH_TABLE_MIN_CASES	4
+
+	// Where an OP_SWITCH goes for each case, numbers index a dense array and strings are hashed.
+	// Values without a case go to m_default.
+	struct SwitchTable
+	{
+		SwitchTable ()
+		:
+			m_low	  (0),
+			m_default (0)
+		{}
+
+		uint32_t find (double_t value) const
+		{
+			double_t index = value - m_low;
+
+			if (index >= 0 && index < m_numbers.size () && std::floor (index) == index) {
+				return m_numbers[static_cast<uint32_t> (index)];
+			}
+
+			return m_default;
+		}
+
+		uint32_t find (const std::string& value) const
+		{
+			auto found = m_strings.find (value);
+			return (found != m_strings.end ())? found->second : m_default;
+		}
+
+		// Calls func with a reference to every address in the table
+		template <typename F>
+		void each_target (F func)
+		{
+			for (uint32_t i = 0; i < m_numbers.size (); i++) {
+				func (m_numbers[i]);
+			}
+
+			for (auto i = m_strings.begin (); i != m_strings.end (); ++i) {
+				func (i->second);
+			}
+
+			func (m_default);
+		}
+
+		double_t m_low;		// The case m_low + i goes to m_numbers[i]
+		std::vector<uint32_t> m_numbers;
+		std::unordered_map<std::string, uint32_t> m_strings;
+		uint32_t m_default;
+	};
+
 	class CodeBlock
 	{
 		public:
@@ -130,6 +270,11 @@ namespace Signal
 			m_instructions.push_back (Instruction (op, arg, object));
 		}
 
+		void write(OpCode op, uint32_t arg, uint32_t arg2, std::shared_ptr<Object> object)
+		{
+			m_instructions.push_back (Instruction (op, arg, arg2, object));
+		}
+
 		Instruction& operator[] (uint32_t i)
 		{ 
 			return m_instructions[i]; 
@@ -140,8 +285,45 @@ namespace Signal
 			return m_instructions.size ();
 		}
 
+		// Replaces the code with a rewritten version of it, see Peephole
+		void swap (std::vector<Instruction>& instructions)
+		{
+			m_instructions.swap (instructions);
+		}
+
+		// Member call sites, numbered in order. Only the selector is kept here, the caches are filled in by
+		// each interpreter.
+		uint32_t add_cache (uint32_t selector)
+		{
+			m_selectors.push_back (selector);
+			return m_selectors.size () - 1;
+		}
+
+		uint32_t caches () const
+		{
+			return m_selectors.size ();
+		}
+
+		uint32_t selector (uint32_t i) const
+		{
+			return m_selectors[i];
+		}
+
+		uint32_t add_switch (const SwitchTable& table)
+		{
+			m_switches.push_back (table);
+			return m_switches.size () - 1;
+		}
+
+		SwitchTable& switch_table (uint32_t i)
+		{
+			return m_switches[i];
+		}
+
 		private:
 
 		std::vector<Instruction> m_instructions;
+		std::vector<uint32_t> m_selectors;
+		std::vector<SwitchTable> m_switches;
 	};
 }
\ No newline at end of file
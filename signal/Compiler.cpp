@@ -2,16 +2,17 @@
 
 namespace Signal
 {
-	void Compiler::Compile (Environment& env, std::shared_ptr<AST> ast)
+	void Compiler::Compile (Environment& env, std::shared_ptr<AST> ast, bool optimize)
 	{
-		Compiler compiler = Compiler(env);
+		Compiler compiler = Compiler(env, optimize);
 
 		compiler.visit (*ast);
 	}
 
-	Compiler::Compiler (Environment& env)
+	Compiler::Compiler (Environment& env, bool optimize)
 	:
-		m_env (env)
+		m_env	   (env),
+		m_optimize (optimize)
 	{}
 
 	void Compiler::visit (const AST& ast)
@@ -23,9 +24,35 @@ namespace Signal
 			class_def[i]->accept (*this);
 		}
 
+		for (uint32_t i = 0; i < func_decl.size (); i++) {
+			if (auto global = std::dynamic_pointer_cast<ASTGFuncDecl> (func_decl[i])) {
+				std::shared_ptr<Function> new_func (new Function (global->name(), global->args ()));
+				m_env.add_func (new_func);
+				m_declared[global.get ()] = new_func;
+			}
+		}
+
 		for (uint32_t i = 0; i < func_decl.size (); i++) {
 			func_decl[i]->accept (*this);
 		}
+
+		// Calls can only be inlined once the functions they call are compiled
+		if (m_optimize) {
+			for (uint32_t i = 0; i < m_compiled.size (); i++) {
+				if (inline_calls (m_compiled[i])) {
+					Peephole::Optimize (*m_compiled[i]->code ());
+					size_frame (m_compiled[i]);
+				}
+			}
+
+			for (uint32_t i = 0; i < m_compiled.size (); i++) {
+				specialize (m_compiled[i]);
+
+				if (hoist_invariants (m_compiled[i])) {
+					size_frame (m_compiled[i]);
+				}
+			}
+		}
 	}
 
 	void Compiler::visit (const ASTClassDef& class_def)
@@ -69,29 +96,25 @@ namespace Signal
 			ThrowCompileError("Compiler : Class '%s' does not define the function '%s'.", func_decl.base ().c_str (), func_decl.name().c_str());
 		}
 
-		for (int32_t i = func_decl.args ().size () - 1; i >= 0; i--) {
-			func->code()->write (OP_SET, std::shared_ptr<Object> (new String (func_decl.args()[i])));
-			func->code()->write (OP_POP);
-		}
-
 		if (func_decl.body().get() != nullptr) {
 			func_decl.body()->accept (*this, func);
 
 			// We add this in case the user explicitly doesn't return anything in which case the function is void.
 			func->code ()->write (OP_PUSH, m_env.obj_nil());
 			func->code ()->write (OP_RETURN);
+			m_compiled.push_back (func);
+		}
+
+		if (m_optimize) {
+			Peephole::Optimize (*func->code ());
 		}
+
+		size_frame (func);
 	}
 
 	void Compiler::visit (const ASTGFuncDecl& func_decl)
 	{
-		std::shared_ptr<Function> new_func (new Function (func_decl.name(), func_decl.args ()));
-		m_env.add_func(new_func);
-
-		for (int32_t i = func_decl.args ().size () - 1; i >= 0; i--) {
-			new_func->code ()->write (OP_SET, std::shared_ptr<Object>(new String(func_decl.args()[i])));
-			new_func->code ()->write (OP_POP);
-		}
+		std::shared_ptr<Function> new_func = m_declared[&func_decl];
 
 		if (func_decl.body ().get () != nullptr) {
 			func_decl.body ()->accept (*this, new_func);
@@ -99,7 +122,14 @@ namespace Signal
 			// We add this in case the user explicitly doesn't return anything in which case the function is void.
 			new_func->code()->write (OP_PUSH, m_env.obj_nil ());
 			new_func->code()->write (OP_RETURN);
+			m_compiled.push_back (new_func);
+		}
+
+		if (m_optimize) {
+			Peephole::Optimize (*new_func->code ());
 		}
+
+		size_frame (new_func);
 	}
 
 	void Compiler::visit (const ASTVarDef& var_def, std::shared_ptr<Class> _class)
@@ -111,7 +141,7 @@ namespace Signal
 	void Compiler::visit (const ASTFuncDef& func_def, std::shared_ptr<Class> _class)
 	{
 		std::shared_ptr<Function> func (new Function (func_def.name(), func_def.args ()));
-		_class->add_func (func);
+		_class->add_func (func, m_env.selector (func_def.name()));
 	}
 
 	void Compiler::visit (const ASTBlock& block, std::shared_ptr<Function> func)
@@ -137,12 +167,19 @@ namespace Signal
 		// Compile the if part
 		if_stmt.if_part ()->accept (*this, func);
 
-		// We set the offset after we compile the if part
-		Instruction& brf = (*code)[index];
-		brf.m_arg = code->count ();
+		if (if_stmt.else_part().get () == nullptr) {
+			// We set the offset after we compile the if part
+			(*code)[index].m_arg = code->count ();
+			return;
+		}
+
+		// The if part jumps over the else part
+		code->write (OP_BR, 0);
+		uint32_t skip = code->count () - 1;
 
-		if (if_stmt.else_part().get () != nullptr)
-			if_stmt.else_part()->accept (*this, func);
+		(*code)[index].m_arg = code->count ();
+		if_stmt.else_part()->accept (*this, func);
+		(*code)[skip].m_arg = code->count ();
 	}
 
 	void Compiler::visit (const ASTWhile& while_stmt, std::shared_ptr<Function> func)
@@ -158,6 +195,7 @@ namespace Signal
 		uint32_t condBranch = code->count() - 1;
 
 		// compile the body
+		m_contexts.push_back(JumpContext(true));
 		while_stmt.body()->accept(*this, func);
 
 		// branch back to the condition
@@ -168,24 +206,24 @@ namespace Signal
 		Instruction& brf = (*code)[condBranch];
 		brf.m_arg = end;
 
-		// fill breaks/continues
-		for (uint32_t i = cond; i < end; i++)
-		{
-			Instruction& inst = (*code)[i];
-			if (inst.m_op == OP_BR && inst.m_arg == 0xDEADBEEF) // break, jump to end
-				inst.m_arg = end;
-			else if (inst.m_op == OP_BR && inst.m_arg == 0xFEEDBEAD) //continue, jump to condition
-				inst.m_arg = cond;
-		}
+		// breaks jump to the end, continues to the condition
+		JumpContext& context = m_contexts.back();
+		patch(func, context.m_breaks, end);
+		patch(func, context.m_continues, cond);
+		m_contexts.pop_back();
 	}
 
 	void Compiler::visit (const ASTFor& for_stmt, std::shared_ptr<Function> func)
 	{
+		if (compile_numeric_for (for_stmt, func))
+			return;
+
 		std::shared_ptr<CodeBlock> code = func->code();
 
 		// init the loop variables
 		uint32_t init = code->count();
 		for_stmt.init()->accept(*this, func);
+		code->write(OP_POP);
 
 		// do conition
 		uint32_t cond = code->count();
@@ -196,11 +234,13 @@ namespace Signal
 		uint32_t condition = code->count() - 1;
 
 		// compile the body
+		m_contexts.push_back(JumpContext(true));
 		for_stmt.body()->accept(*this, func);
 
 		// increment condition
 		uint32_t inc = code->count();
 		for_stmt.inc()->accept(*this, func);
+		code->write(OP_POP);
 
 		// branch back to the condition
 		code->write(OP_BR, cond);
@@ -210,29 +250,1138 @@ namespace Signal
 		Instruction& brf = (*code)[condition];
 		brf.m_arg = end;
 
-		// fill breaks/continues
-		for (uint32_t i = cond; i < end; i++)
+		// breaks jump to the end, continues to the increment
+		JumpContext& context = m_contexts.back();
+		patch(func, context.m_breaks, end);
+		patch(func, context.m_continues, inc);
+		m_contexts.pop_back();
+	}
+
+	// Locals live in frame slots. Names the function can only see through its scope (class members) are
+	// looked up on the receiver at runtime, anything else becomes a new local.
+	void Compiler::load (const std::string& name, std::shared_ptr<Function> func)
+	{
+		uint32_t slot;
+
+		if (!func->find_local (name, slot) && func->scope ()->find (name).get () != nullptr) {
+			func->code ()->write (OP_LOAD_MEMBER, std::shared_ptr<Object> (new String (name)));
+		} else {
+			func->code ()->write (OP_LOAD_LOCAL, func->define_local (name));
+		}
+	}
+
+	void Compiler::store (const std::string& name, std::shared_ptr<Function> func)
+	{
+		uint32_t slot;
+
+		if (!func->find_local (name, slot) && func->scope ()->find (name).get () != nullptr) {
+			func->code ()->write (OP_STORE_MEMBER, std::shared_ptr<Object> (new String (name)));
+		} else {
+			func->code ()->write (OP_STORE_LOCAL, func->define_local (name));
+		}
+	}
+
+	void Compiler::update (const std::string& name, OpCode op, std::shared_ptr<Function> func)
+	{
+		uint32_t slot;
+
+		if (!func->find_local (name, slot) && func->scope ()->find (name).get () != nullptr) {
+			func->code ()->write (OP_UPDATE_MEMBER, 0, op, std::shared_ptr<Object> (new String (name)));
+		} else {
+			func->code ()->write (OP_UPDATE_LOCAL, func->define_local (name), op, std::shared_ptr<Object> ());
+		}
+	}
+
+	// Replaces calls to small global functions with a copy of their code. The callee's arguments and locals
+	// move into hidden locals of the caller and its returns branch to the end of the copy. Calls are bound to
+	// a function when they are compiled, so a later definition with the same name doesn't affect them.
+	bool Compiler::inline_calls (std::shared_ptr<Function> func)
+	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+		std::vector<Instruction> instructions;
+		std::vector<bool> copied;
+		std::vector<uint32_t> address (code->count () + 1);
+
+		for (uint32_t i = 0; i < code->count (); i++) {
+			const Instruction& instruction = (*code)[i];
+			address[i] = instructions.size ();
+
+			if (instruction.m_op != OP_CALL || !inlinable (m_env.func (instruction.m_arg))) {
+				instructions.push_back (instruction);
+				copied.push_back (false);
+				continue;
+			}
+
+			std::shared_ptr<Function> callee = m_env.func (instruction.m_arg);
+			std::shared_ptr<CodeBlock> body = callee->code ();
+			uint32_t num_args = callee->args ().size ();
+
+			// Copies run one after the other, so every call site can share the same hidden locals
+			std::vector<uint32_t> slots;
+
+			for (uint32_t j = 0; j < callee->locals (); j++) {
+				std::stringstream name;
+				name << "[-inline-" << j << "-]";
+				slots.push_back (func->define_local (name.str ()));
+			}
+
+			std::vector<bool> loaded (slots.size (), false);
+
+			for (uint32_t j = 0; j < body->count (); j++) {
+				if ((*body)[j].m_op == OP_LOAD_LOCAL || (*body)[j].m_op == OP_UPDATE_LOCAL) {
+					loaded[(*body)[j].m_arg] = true;
+				}
+			}
+
+			// The last argument is on top of the stack, the callee's other locals start out as nil
+			for (uint32_t j = num_args; j > 0; j--) {
+				instructions.push_back (Instruction (OP_STORE_LOCAL, slots[j - 1]));
+				instructions.push_back (Instruction (OP_POP));
+			}
+
+			for (uint32_t j = num_args; j < slots.size (); j++) {
+				if (!loaded[j]) {
+					continue;
+				}
+
+				instructions.push_back (Instruction (OP_NIL));
+				instructions.push_back (Instruction (OP_STORE_LOCAL, slots[j]));
+				instructions.push_back (Instruction (OP_POP));
+			}
+
+			uint32_t start = instructions.size ();
+			uint32_t end = start + body->count ();
+
+			copied.resize (start, false);
+
+			for (uint32_t j = 0; j < body->count (); j++) {
+				Instruction copy = (*body)[j];
+
+				switch (copy.m_op)
+				{
+					case OP_LOAD_LOCAL:
+					case OP_STORE_LOCAL:
+					case OP_UPDATE_LOCAL:
+						copy.m_arg = slots[copy.m_arg];
+						break;
+
+					case OP_RETURN:
+						copy = Instruction (OP_BR, end);
+						break;
+
+					case OP_BR:
+					case OP_BRT:
+					case OP_BRF:
+					case OP_BRT_OR_POP:
+					case OP_BRF_OR_POP:
+						copy.m_arg += start;
+						break;
+
+					default:
+						break;
+				}
+
+				instructions.push_back (copy);
+				copied.push_back (true);
+			}
+		}
+
+		address[code->count ()] = instructions.size ();
+
+		if (instructions.size () == code->count ()) {
+			return false;
+		}
+
+		// The caller's own branches move with the code they point at
+		for (uint32_t i = 0; i < instructions.size (); i++) {
+			Instruction& instruction = instructions[i];
+
+			if (copied[i]) {
+				continue;
+			}
+
+			switch (instruction.m_op)
+			{
+				case OP_BR:
+				case OP_BRT:
+				case OP_BRF:
+				case OP_BRT_OR_POP:
+				case OP_BRF_OR_POP:
+				case OP_FORPREP:
+				case OP_FORLOOP:
+					instruction.m_arg = address[std::min (instruction.m_arg, code->count ())];
+					break;
+
+				case OP_SWITCH:
+					code->switch_table (instruction.m_arg).each_target ([&] (uint32_t& target) {
+						target = address[std::min (target, code->count ())];
+					});
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		code->swap (instructions);
+		return true;
+	}
+
+	// Small functions that don't call anything, loop, or use member variables or tables of their own
+	bool Compiler::inlinable (const std::shared_ptr<Function>& func)
+	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+
+		if (code->count () == 0 || code->count () > INLINE_MAX_INSTRUCTIONS) {
+			return false;
+		}
+
+		for (uint32_t i = 0; i < code->count (); i++) {
+			const Instruction& instruction = (*code)[i];
+
+			switch (instruction.m_op)
+			{
+				case OP_CALL:
+				case OP_TAILCALL:
+				case OP_MCALL:
+				case OP_LOAD_MEMBER:
+				case OP_STORE_MEMBER:
+				case OP_UPDATE_MEMBER:
+				case OP_SWITCH:
+				case OP_FORPREP:
+				case OP_FORLOOP:
+					return false;
+
+				case OP_BR:
+				case OP_BRT:
+				case OP_BRF:
+				case OP_BRT_OR_POP:
+				case OP_BRF_OR_POP:
+					if (instruction.m_arg <= i) {
+						return false;
+					}
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		return true;
+	}
+
+	// Follows every path through the function's code to find how deep its operand stack can get,
+	// so the interpreter can check a whole call against its stack limit up front.
+	void Compiler::size_frame (std::shared_ptr<Function> func)
+	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+		std::vector<int32_t> depth (code->count (), -1);
+		std::vector<uint32_t> work;
+		int32_t deepest = 0;
+
+		if (code->count () > 0) {
+			depth[0] = 0;
+			work.push_back (0);
+		}
+
+		while (!work.empty ()) {
+			uint32_t at = work.back ();
+			work.pop_back ();
+
+			const Instruction& instruction = (*code)[at];
+			int32_t after = depth[at] + stack_effect (instruction);
+
+			deepest = std::max (deepest, after);
+
+			// Successors and the depth they are reached with
+			uint32_t next[2];
+			int32_t next_depth[2];
+			uint32_t count = 0;
+
+			switch (instruction.m_op)
+			{
+				case OP_RETURN:
+				case OP_TAILCALL:
+					break;
+
+				case OP_BR:
+					next[count] = instruction.m_arg; next_depth[count++] = depth[at];
+					break;
+
+				case OP_BRT_OR_POP:
+				case OP_BRF_OR_POP:
+					next[count] = instruction.m_arg; next_depth[count++] = depth[at];
+					next[count] = at + 1; next_depth[count++] = after;
+					break;
+
+				case OP_BRT:
+				case OP_BRF:
+				case OP_FORPREP:
+				case OP_FORLOOP:
+					next[count] = instruction.m_arg; next_depth[count++] = after;
+					next[count] = at + 1; next_depth[count++] = after;
+					break;
+
+				default:
+					next[count] = at + 1; next_depth[count++] = after;
+					break;
+			}
+
+			for (uint32_t i = 0; i < count; i++) {
+				if (next[i] < code->count () && depth[next[i]] == -1) {
+					depth[next[i]] = next_depth[i];
+					work.push_back (next[i]);
+				}
+			}
+
+			// A switch can also go to any of its cases
+			if (instruction.m_op == OP_SWITCH) {
+				code->switch_table (instruction.m_arg).each_target ([&] (uint32_t& target) {
+					if (target < code->count () && depth[target] == -1) {
+						depth[target] = after;
+						work.push_back (target);
+					}
+				});
+			}
+		}
+
+		func->set_frame_size (func->locals () + deepest);
+	}
+
+	// How many objects an instruction leaves on the stack compared to before it ran
+	int32_t Compiler::stack_effect (const Instruction& instruction)
+	{
+		switch (instruction.m_op)
+		{
+			case OP_PUSH:
+			case OP_DUP:
+			case OP_NIL:
+			case OP_NEW:
+			case OP_LOAD_MEMBER:
+			case OP_LOAD_LOCAL:
+				return 1;
+
+			case OP_CALL:
+				return 1 - static_cast<int32_t> (m_env.func (instruction.m_arg)->args ().size ());
+
+			case OP_TAILCALL:
+				return -static_cast<int32_t> (m_env.func (instruction.m_arg)->args ().size ());
+
+			case OP_MCALL:
+				return -static_cast<int32_t> (instruction.m_arg);
+
+			case OP_ECALL:
+				return 1 - static_cast<int32_t> (instruction.m_arg2);
+
+			case OP_FORPREP:
+				return -3;
+
+			case OP_POP:
+			case OP_SWITCH:
+			case OP_RETURN:
+			case OP_BRT:
+			case OP_BRF:
+			case OP_BRT_OR_POP:
+			case OP_BRF_OR_POP:
+			case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+			case OP_EQEQ: case OP_NEQ: case OP_LT: case OP_GT: case OP_LTE: case OP_GTE:
+			case OP_QADD: case OP_QSUB: case OP_QMUL: case OP_QDIV:
+			case OP_QEQEQ: case OP_QNEQ: case OP_QLT: case OP_QGT: case OP_QLTE: case OP_QGTE:
+			case OP_NADD: case OP_NSUB: case OP_NMUL: case OP_NDIV:
+			case OP_NEQEQ: case OP_NNEQ: case OP_NLT: case OP_NGT: case OP_NLTE: case OP_NGTE:
+				return -1;
+
+			default:
+				return 0;
+		}
+	}
+
+	// Switches arithmetic and comparisons on two proven numbers to the OP_N forms that skip the type checks
+	void Compiler::specialize (std::shared_ptr<Function> func)
+	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+		std::vector<std::vector<bool>> stack;
+		std::vector<bool> reached;
+
+		infer_numbers (func, stack, reached);
+
+		for (uint32_t i = 0; i < code->count (); i++) {
+			Instruction& instruction = (*code)[i];
+			const std::vector<bool>& values = stack[i];
+			OpCode number_op = number_form (instruction.m_op);
+
+			if (number_op != instruction.m_op && values.size () >= 2 && values[values.size () - 1] && values[values.size () - 2]) {
+				instruction.m_op = number_op;
+			}
+		}
+	}
+
+	// Finds which stack values are numbers on every path to each instruction. Locals only change through
+	// OP_STORE_LOCAL and counted for loops, so a local given a number on every path to an instruction
+	// still holds one there.
+	void Compiler::infer_numbers (std::shared_ptr<Function> func, std::vector<std::vector<bool>>& stack, std::vector<bool>& reached)
+	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+
+		// What is known before each instruction
+		std::vector<std::vector<bool>> locals (code->count ());
+		std::vector<uint32_t> work;
+
+		stack.assign (code->count (), std::vector<bool> ());
+		reached.assign (code->count (), false);
+
+		if (code->count () == 0) {
+			return;
+		}
+
+		// Arguments can be anything and the other locals start out as nil
+		locals[0].assign (func->locals (), false);
+		reached[0] = true;
+		work.push_back (0);
+
+		// Merges what is known on one more path into an instruction, a value is only a number if it is on every path
+		auto flow = [&] (uint32_t to, const std::vector<bool>& local, const std::vector<bool>& values) {
+			if (to >= code->count ()) {
+				return;
+			}
+
+			if (!reached[to]) {
+				reached[to] = true;
+				locals[to] = local;
+				stack[to] = values;
+				work.push_back (to);
+				return;
+			}
+
+			bool changed = false;
+
+			for (uint32_t i = 0; i < local.size (); i++) {
+				if (locals[to][i] && !local[i]) {
+					locals[to][i] = false;
+					changed = true;
+				}
+			}
+
+			for (uint32_t i = 0; i < values.size () && i < stack[to].size (); i++) {
+				if (stack[to][i] && !values[i]) {
+					stack[to][i] = false;
+					changed = true;
+				}
+			}
+
+			if (changed) {
+				work.push_back (to);
+			}
+		};
+
+		while (!work.empty ()) {
+			uint32_t at = work.back ();
+			work.pop_back ();
+
+			const Instruction& instruction = (*code)[at];
+			std::vector<bool> local = locals[at];
+			std::vector<bool> values = stack[at];
+
+			number_step (instruction, local, values);
+
+			switch (instruction.m_op)
+			{
+				case OP_RETURN:
+				case OP_TAILCALL:
+					break;
+
+				case OP_BR:
+					flow (instruction.m_arg, local, values);
+					break;
+
+				// The branch keeps the value it tested
+				case OP_BRT_OR_POP:
+				case OP_BRF_OR_POP:
+					flow (instruction.m_arg, locals[at], stack[at]);
+					flow (at + 1, local, values);
+					break;
+
+				case OP_BRT:
+				case OP_BRF:
+				case OP_FORPREP:
+				case OP_FORLOOP:
+					flow (instruction.m_arg, local, values);
+					flow (at + 1, local, values);
+					break;
+
+				case OP_SWITCH:
+					code->switch_table (instruction.m_arg).each_target ([&] (uint32_t& target) {
+						flow (target, local, values);
+					});
+					flow (at + 1, local, values);
+					break;
+
+				default:
+					flow (at + 1, local, values);
+					break;
+			}
+		}
+	}
+
+	// What an instruction does to which locals and stack values are numbers. Instructions that throw
+	// for anything but numbers leave a number when they carry on.
+	void Compiler::number_step (const Instruction& instruction, std::vector<bool>& locals, std::vector<bool>& stack)
+	{
+		switch (instruction.m_op)
+		{
+			case OP_PUSH:
+				stack.push_back (instruction.m_object->type () == Object::NUMBER);
+				break;
+
+			case OP_DUP:
+				stack.push_back (stack.back ());
+				break;
+
+			case OP_LOAD_LOCAL:
+				stack.push_back (locals[instruction.m_arg]);
+				break;
+
+			case OP_STORE_LOCAL:
+				locals[instruction.m_arg] = stack.back ();
+				break;
+
+			case OP_FORPREP:
+				stack.resize (stack.size () - 3);
+				locals[instruction.m_arg2] = true;
+				break;
+
+			case OP_FORLOOP:
+				locals[instruction.m_arg2] = true;
+				break;
+
+			// Works like the operator followed by a store
+			case OP_UPDATE_LOCAL:
+			{
+				bool number = instruction.m_arg2 == OP_SUB || instruction.m_arg2 == OP_MUL ||
+							  (instruction.m_arg2 == OP_ADD && locals[instruction.m_arg] && stack.back ());
+
+				locals[instruction.m_arg] = number;
+				stack.back () = number;
+			}
+			break;
+
+			case OP_ADD:
+			case OP_QADD:
+			case OP_NADD:
+			{
+				bool numbers = stack[stack.size () - 1] && stack[stack.size () - 2];
+				stack.pop_back ();
+				stack.back () = numbers;
+			}
+			break;
+
+			case OP_SUB: case OP_MUL:
+			case OP_QSUB: case OP_QMUL:
+			case OP_NSUB: case OP_NMUL:
+				stack.pop_back ();
+				stack.back () = true;
+				break;
+
+			case OP_NEG:
+			case OP_INC:
+			case OP_DEC:
+				stack.back () = true;
+				break;
+
+			// Division by zero gives nil
+			case OP_DIV: case OP_QDIV: case OP_NDIV: case OP_MOD:
+			case OP_EQEQ: case OP_NEQ: case OP_LT: case OP_GT: case OP_LTE: case OP_GTE:
+			case OP_QEQEQ: case OP_QNEQ: case OP_QLT: case OP_QGT: case OP_QLTE: case OP_QGTE:
+			case OP_NEQEQ: case OP_NNEQ: case OP_NLT: case OP_NGT: case OP_NLTE: case OP_NGTE:
+				stack.pop_back ();
+				stack.back () = false;
+				break;
+
+			case OP_NOT:
+				stack.back () = false;
+				break;
+
+			// Everything else pushes something that isn't known to be a number, or only pops
+			default:
+			{
+				uint32_t pushes = produces (instruction.m_op)? 1 : 0;
+
+				stack.resize (stack.size () + stack_effect (instruction) - pushes);
+
+				if (pushes) {
+					stack.push_back (false);
+				}
+			}
+			break;
+		}
+	}
+
+	// Instructions that pop their operands and push a result
+	bool Compiler::produces (OpCode op)
+	{
+		switch (op)
+		{
+			case OP_STORE_LOCAL:
+			case OP_STORE_MEMBER:
+			case OP_INC:
+			case OP_DEC:
+				return false;
+
+			case OP_UPDATE_LOCAL:
+			case OP_UPDATE_MEMBER:
+				return true;
+
+			case OP_PUSH:
+			case OP_DUP:
+			case OP_NIL:
+			case OP_NEW:
+			case OP_CALL:
+			case OP_MCALL:
+			case OP_ECALL:
+			case OP_LOAD_MEMBER:
+			case OP_LOAD_LOCAL:
+			case OP_NEG:
+			case OP_NOT:
+				return true;
+
+			default:
+				return op >= OP_ADD && op <= OP_NGTE;
+		}
+	}
+
+	// Moves code that computes the same value on every iteration of a loop in front of the loop. Only
+	// arithmetic on proven numbers and calls to pure exported functions are moved, they can't fail or
+	// have side effects however often they run. Calls are only moved from the loop's first block, which
+	// runs whenever the loop is entered, so the loop would have made them anyway. Loops that call script
+	// functions or use ++ and -- are left alone, those can change a number in place through another
+	// variable that holds it.
+	bool Compiler::hoist_invariants (std::shared_ptr<Function> func)
+	{
+		bool changed = false;
+		bool hoisted = true;
+
+		// Moving code shifts every address after it, so start over after each loop
+		while (hoisted) {
+			std::shared_ptr<CodeBlock> code = func->code ();
+			std::map<uint32_t, uint32_t> ends;
+			std::vector<std::vector<bool>> stack;
+			std::vector<bool> reached;
+
+			infer_numbers (func, stack, reached);
+
+			// A loop runs from the target of its backward branches to the last of them
+			for (uint32_t i = 0; i < code->count (); i++) {
+				const Instruction& instruction = (*code)[i];
+
+				if ((instruction.m_op == OP_BR || instruction.m_op == OP_FORLOOP) && instruction.m_arg <= i) {
+					ends[instruction.m_arg] = std::max (ends[instruction.m_arg], i);
+				}
+			}
+
+			// Inner loops go first, what they move out may be invariant in the loop around them too
+			std::vector<std::pair<uint32_t, uint32_t>> loops (ends.begin (), ends.end ());
+			std::sort (loops.begin (), loops.end (), [] (const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+				return a.second - a.first < b.second - b.first;
+			});
+
+			hoisted = false;
+
+			for (uint32_t i = 0; i < loops.size () && !hoisted; i++) {
+				hoisted = hoist_loop (func, loops[i].first, loops[i].second, stack, reached);
+			}
+
+			changed = changed || hoisted;
+		}
+
+		return changed;
+	}
+
+	// Hoists the invariant code of the loop [head, end], see hoist_invariants
+	bool Compiler::hoist_loop (std::shared_ptr<Function> func, uint32_t head, uint32_t end, const std::vector<std::vector<bool>>& stack, const std::vector<bool>& reached)
+	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+		uint32_t count = code->count ();
+		std::vector<bool> stored (func->locals (), false);
+		std::vector<bool> leader (count + 1, false);
+		bool entered = false;
+
+		for (uint32_t i = 0; i < count; i++) {
+			const Instruction& instruction = (*code)[i];
+			bool inside = i >= head && i <= end;
+
+			// The loop can only be entered through its head
+			auto target = [&] (uint32_t address) {
+				leader[std::min (address, count)] = true;
+				entered = entered || (!inside && address > head && address <= end);
+			};
+
+			if (Peephole::is_branch (instruction)) {
+				target (instruction.m_arg);
+			} else if (instruction.m_op == OP_SWITCH) {
+				code->switch_table (instruction.m_arg).each_target (target);
+			}
+
+			if (Peephole::is_branch (instruction) || Peephole::ends_block (instruction) || instruction.m_op == OP_SWITCH) {
+				leader[i + 1] = true;
+			}
+
+			if (!inside) {
+				continue;
+			}
+
+			if (!reached[i]) {
+				return false;
+			}
+
+			switch (instruction.m_op)
+			{
+				case OP_CALL:
+				case OP_TAILCALL:
+				case OP_MCALL:
+				case OP_INC:
+				case OP_DEC:
+					return false;
+
+				case OP_STORE_LOCAL:
+				case OP_UPDATE_LOCAL:
+					stored[instruction.m_arg] = true;
+					break;
+
+				case OP_FORPREP:
+				case OP_FORLOOP:
+					stored[instruction.m_arg2] = true;
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		if (entered) {
+			return false;
+		}
+
+		// A value on the stack and the invariant code [m_start, m_end) that computes it, m_start is -1 when it isn't invariant
+		struct Value
 		{
-			Instruction& inst = (*code)[i];
-			if (inst.m_op == OP_BR && inst.m_arg == 0xDEADBEEF) // break, jump to end
-				inst.m_arg = end;
-			else if (inst.m_op == OP_BR && inst.m_arg == 0xFEEDBEAD) //continue, jump to increment
-				inst.m_arg = inc;
+			int32_t  m_start;
+			uint32_t m_end;
+			bool	 m_computed;	// Only worth moving when it does more than push a constant or local
+		};
+
+		std::vector<Value> values;
+		std::vector<std::pair<uint32_t, uint32_t>> moves;
+		const Value unknown = { -1, 0, false };
+
+		// Still in the loop's first block, every path into the loop runs it before anything can leave
+		bool opening = true;
+
+		// The top n values are used by something that stays in the loop
+		auto use = [&] (uint32_t n) {
+			for (uint32_t i = values.size () - n; i < values.size (); i++) {
+				if (values[i].m_start >= 0 && values[i].m_computed) {
+					moves.push_back (std::make_pair (values[i].m_start, values[i].m_end));
+				}
+			}
+
+			values.resize (values.size () - n);
+		};
+
+		for (uint32_t i = head; i <= end; i++) {
+			const Instruction& instruction = (*code)[i];
+
+			// Values coming from other blocks aren't tracked
+			if (leader[i]) {
+				use (values.size ());
+				values.assign (stack[i].size (), unknown);
+				opening = opening && i == head;
+			}
+
+			switch (instruction.m_op)
+			{
+				case OP_PUSH:
+				{
+					Value value = { static_cast<int32_t> (i), i + 1, false };
+					values.push_back (value);
+				}
+				break;
+
+				case OP_LOAD_LOCAL:
+				{
+					Value value = { static_cast<int32_t> (i), i + 1, false };
+					values.push_back (stored[instruction.m_arg]? unknown : value);
+				}
+				break;
+
+				case OP_NADD: case OP_NSUB: case OP_NMUL: case OP_NDIV:
+				case OP_NEQEQ: case OP_NNEQ: case OP_NLT: case OP_NGT: case OP_NLTE: case OP_NGTE:
+				{
+					Value& left = values[values.size () - 2];
+					Value& right = values[values.size () - 1];
+
+					if (left.m_start >= 0 && right.m_start >= 0) {
+						Value value = { left.m_start, i + 1, true };
+						values.resize (values.size () - 2);
+						values.push_back (value);
+					} else {
+						use (2);
+						values.push_back (unknown);
+					}
+				}
+				break;
+
+				case OP_ECALL:
+				{
+					const std::shared_ptr<Native>& native = m_env.exported (instruction.m_arg);
+					uint32_t num_args = instruction.m_arg2;
+					uint32_t first = values.size () - num_args;
+					bool invariant = opening && native->pure () && native->arity () == static_cast<int32_t> (num_args);
+
+					// The function has to take the arguments, or it would throw. A constant is checked itself,
+					// a computed number only when the function takes any number.
+					for (uint32_t j = 0; j < num_args && invariant; j++) {
+						const Value& arg = values[first + j];
+
+						if (arg.m_start < 0) {
+							invariant = false;
+							break;
+						}
+
+						const Instruction& push = (*code)[arg.m_start];
+
+						if (arg.m_end == arg.m_start + 1 && push.m_op == OP_PUSH) {
+							invariant = native->accepts (j, push.m_object->type ()) && native->converts (j, push.m_object.get ());
+						} else if (stack[i][stack[i].size () - num_args + j]) {
+							invariant = native->accepts (j, Object::NUMBER) && native->converts (j, nullptr);
+						} else {
+							invariant = false;
+						}
+					}
+
+					if (invariant) {
+						Value value = { (num_args > 0)? values[first].m_start : static_cast<int32_t> (i), i + 1, true };
+						values.resize (first);
+						values.push_back (value);
+					} else {
+						use (num_args);
+						values.push_back (unknown);
+					}
+				}
+				break;
+
+				// Stores leave the value on the stack
+				case OP_STORE_LOCAL:
+				case OP_STORE_MEMBER:
+					use (1);
+					values.push_back (unknown);
+					break;
+
+				case OP_DUP:
+					use (1);
+					values.push_back (unknown);
+					values.push_back (unknown);
+					break;
+
+				default:
+				{
+					uint32_t pushes = produces (instruction.m_op)? 1 : 0;
+
+					use (pushes - stack_effect (instruction));
+
+					if (pushes) {
+						values.push_back (unknown);
+					}
+				}
+				break;
+			}
+		}
+
+		use (values.size ());
+
+		if (moves.empty ()) {
+			return false;
+		}
+
+		std::sort (moves.begin (), moves.end ());
+
+		// Each moved value is computed once in front of the loop into a hidden local
+		std::vector<uint32_t> slots;
+
+		for (uint32_t i = 0; i < moves.size (); i++) {
+			std::stringstream name;
+			name << "[-hoist-" << func->locals () << "-]";
+			slots.push_back (func->define_local (name.str ()));
+		}
+
+		std::vector<Instruction> instructions;
+		std::vector<uint32_t> address (count + 1);
+		std::vector<int32_t> origin;
+
+		for (uint32_t i = 0; i < head; i++) {
+			address[i] = instructions.size ();
+			instructions.push_back ((*code)[i]);
+			origin.push_back (i);
+		}
+
+		uint32_t preheader = instructions.size ();
+
+		for (uint32_t i = 0; i < moves.size (); i++) {
+			for (uint32_t j = moves[i].first; j < moves[i].second; j++) {
+				instructions.push_back ((*code)[j]);
+				origin.push_back (-1);
+			}
+
+			instructions.push_back (Instruction (OP_STORE_LOCAL, slots[i]));
+			instructions.push_back (Instruction (OP_POP));
+			origin.push_back (-1);
+			origin.push_back (-1);
 		}
+
+		uint32_t loop_head = instructions.size ();
+		uint32_t next = 0;
+
+		for (uint32_t i = head; i < count; i++) {
+			address[i] = instructions.size ();
+
+			if (next < moves.size () && moves[next].first == i) {
+				for (uint32_t j = i; j < moves[next].second; j++) {
+					address[j] = instructions.size ();
+				}
+
+				instructions.push_back (Instruction (OP_LOAD_LOCAL, slots[next]));
+				origin.push_back (i);
+
+				i = moves[next++].second - 1;
+				continue;
+			}
+
+			instructions.push_back ((*code)[i]);
+			origin.push_back (i);
+		}
+
+		address[count] = instructions.size ();
+
+		// Coming from inside the loop a branch to its head skips the code in front of it
+		for (uint32_t i = 0; i < instructions.size (); i++) {
+			Instruction& instruction = instructions[i];
+
+			if (origin[i] < 0) {
+				continue;
+			}
+
+			bool inside = static_cast<uint32_t> (origin[i]) >= head && static_cast<uint32_t> (origin[i]) <= end;
+
+			auto retarget = [&] (uint32_t& target) {
+				if (target == head) {
+					target = inside? loop_head : preheader;
+				} else {
+					target = address[std::min (target, count)];
+				}
+			};
+
+			if (Peephole::is_branch (instruction)) {
+				retarget (instruction.m_arg);
+			} else if (instruction.m_op == OP_SWITCH) {
+				code->switch_table (instruction.m_arg).each_target (retarget);
+			}
+		}
+
+		code->swap (instructions);
+		return true;
+	}
+
+	// The number-only form of an operator, or the operator itself when it has none
+	OpCode Compiler::number_form (OpCode op)
+	{
+		switch (op)
+		{
+			case OP_ADD:  return OP_NADD;
+			case OP_SUB:  return OP_NSUB;
+			case OP_MUL:  return OP_NMUL;
+			case OP_DIV:  return OP_NDIV;
+			case OP_EQEQ: return OP_NEQEQ;
+			case OP_NEQ:  return OP_NNEQ;
+			case OP_LT:	  return OP_NLT;
+			case OP_GT:	  return OP_NGT;
+			case OP_LTE:  return OP_NLTE;
+			case OP_GTE:  return OP_NGTE;
+			default:	  return op;
+		}
+	}
+
+	// Type of an argument known without running it
+	bool Compiler::literal_type (std::shared_ptr<ASTExpression> expr, Object::Type& type)
+	{
+		expr = single (expr);
+
+		if (std::dynamic_pointer_cast<ASTNumber> (expr)) {
+			type = Object::NUMBER;
+		} else if (std::dynamic_pointer_cast<ASTString> (expr)) {
+			type = Object::STRING;
+		} else if (std::dynamic_pointer_cast<ASTNil> (expr)) {
+			type = Object::NIL;
+		} else if (std::dynamic_pointer_cast<ASTTrue> (expr)) {
+			type = Object::TRUE;
+		} else if (std::dynamic_pointer_cast<ASTFalse> (expr)) {
+			type = Object::FALSE;
+		} else {
+			return false;
+		}
+
+		return true;
+	}
+
+	// Compiles for (i = a; i < b; i = i + c) style loops into FORPREP/FORLOOP. The counter has to start at a
+	// number literal, and as the bound is only evaluated once it has to be a number literal or a local that
+	// the loop never assigns. Returns false when the loop does not have that shape and has to be compiled
+	// the generic way.
+	bool Compiler::compile_numeric_for (const ASTFor& for_stmt, std::shared_ptr<Function> func)
+	{
+		auto init = std::dynamic_pointer_cast<ASTAssignment> (single (for_stmt.init()));
+		auto cond = std::dynamic_pointer_cast<ASTCompare> (single (for_stmt.cond()));
+
+		if (init.get() == nullptr || cond.get() == nullptr)
+			return false;
+
+		// A counter that starts out as anything else could stop being a number, FORLOOP counts unboxed
+		if (std::dynamic_pointer_cast<ASTNumber> (single(init->expr())).get() == nullptr)
+			return false;
+
+		const std::string& name = init->var();
+
+		// Member variables can be changed by any call made from the body
+		if (func->scope()->find(name).get() != nullptr)
+			return false;
+
+		auto counter = std::dynamic_pointer_cast<ASTIdentifier> (cond->left());
+		if (counter.get() == nullptr || counter->name() != name)
+			return false;
+
+		std::shared_ptr<ASTExpression> bound = cond->right();
+		if (auto bound_var = std::dynamic_pointer_cast<ASTIdentifier> (bound))
+		{
+			if (bound_var->name() == name || assigns(for_stmt.body(), bound_var->name()) || assigns(for_stmt.inc(), bound_var->name()))
+				return false;
+			if (func->scope()->find(bound_var->name()).get() != nullptr)
+				return false;
+		}
+		else if (std::dynamic_pointer_cast<ASTNumber> (bound).get() == nullptr)
+			return false;
+
+		// The increment has to be i = i + c, i = i - c, i += c, i -= c, i++ or i--
+		double_t step = 0;
+		std::shared_ptr<ASTExpression> inc = single(for_stmt.inc());
+
+		if (auto assign = std::dynamic_pointer_cast<ASTAssignment> (inc))
+		{
+			auto op = std::dynamic_pointer_cast<ASTBinaryMathOp> (single(assign->expr()));
+			if (assign->var() != name || op.get() == nullptr)
+				return false;
+
+			auto left = std::dynamic_pointer_cast<ASTIdentifier> (op->left());
+			auto right = std::dynamic_pointer_cast<ASTNumber> (op->right());
+			if (left.get() == nullptr || left->name() != name || right.get() == nullptr)
+				return false;
+
+			if (op->op_type() == ASTBinaryMathOp::PLUS)
+				step = right->value();
+			else if (op->op_type() == ASTBinaryMathOp::MINUS)
+				step = -right->value();
+		}
+		else if (auto compound = std::dynamic_pointer_cast<ASTCompoundAssignment> (inc))
+		{
+			auto right = std::dynamic_pointer_cast<ASTNumber> (single(compound->expr()));
+			if (compound->var() != name || right.get() == nullptr)
+				return false;
+
+			if (compound->op_type() == ASTBinaryMathOp::PLUS)
+				step = right->value();
+			else if (compound->op_type() == ASTBinaryMathOp::MINUS)
+				step = -right->value();
+		}
+		else if (auto unary = std::dynamic_pointer_cast<ASTUnaryMathOp> (inc))
+		{
+			auto var = std::dynamic_pointer_cast<ASTIdentifier> (unary->expr());
+			if (var.get() == nullptr || var->name() != name)
+				return false;
+
+			if (unary->op_type() == ASTUnaryMathOp::INCREMENT)
+				step = 1;
+			else if (unary->op_type() == ASTUnaryMathOp::DECREMENT)
+				step = -1;
+		}
+
+		// The comparison has to agree with the direction we count in
+		bool inclusive = false;
+		switch (cond->op_type())
+		{
+			case ASTCompare::LESS_THAN:			  if (step <= 0) return false; break;
+			case ASTCompare::GREATER_THAN:		  if (step >= 0) return false; break;
+			case ASTCompare::LESS_THAN_EQUALS:	  if (step <= 0) return false; inclusive = true; break;
+			case ASTCompare::GREATER_THAN_EQUALS: if (step >= 0) return false; inclusive = true; break;
+			default: return false;
+		}
+
+		if (assigns(for_stmt.body(), name))
+			return false;
+
+		std::shared_ptr<CodeBlock> code = func->code();
+		uint32_t slot = func->define_local(name);
+		func->reserve_loop_slot(slot);
+
+		// init the counter, then hand the bound and step to the loop slot
+		for_stmt.init()->accept(*this, func);
+		code->write(OP_POP);
+		bound->accept(*this, func);
+		code->write(OP_PUSH, std::shared_ptr<Object>(new Number(step)));
+		code->write(OP_PUSH, inclusive ? m_env.obj_true() : m_env.obj_false());
+
+		code->write(OP_FORPREP, 0, slot, std::shared_ptr<Object>());
+		uint32_t prep = code->count() - 1;
+
+		// compile the body, continue jumps to the FORLOOP which does the increment
+		uint32_t body = code->count();
+		m_contexts.push_back(JumpContext(true));
+		for_stmt.body()->accept(*this, func);
+
+		uint32_t inc_address = code->count();
+		code->write(OP_FORLOOP, body, slot, std::shared_ptr<Object>());
+		uint32_t end = code->count();
+
+		(*code)[prep].m_arg = end;
+
+		// breaks jump to the end, continues to the FORLOOP
+		JumpContext& context = m_contexts.back();
+		patch(func, context.m_breaks, end);
+		patch(func, context.m_continues, inc_address);
+		m_contexts.pop_back();
+
+		return true;
 	}
 
 	void Compiler::visit (const ASTSwitch& switch_stmt, std::shared_ptr<Function> func)
 	{
 		auto code = func->code();
 		auto cases = switch_stmt.cases();
-		auto switchObj = std::shared_ptr<Object>(new String("[-switch-]"));
+		uint32_t switchSlot = func->define_local("[-switch-]");
 		
-		// eval our first expression, set it to variable "--switch--"
+		// eval our first expression, keep it in the hidden local "[-switch-]"
 		switch_stmt.expr()->accept(*this, func);
-		code->write(OP_DEF, switchObj);
+		code->write(OP_STORE_LOCAL, switchSlot);
+		code->write(OP_POP);
 
-		// create our jump table
-		uint32_t startJmpTable = code->count();
+		// literal cases are looked up in a table first, the tests below handle everything else
+		SwitchTable table;
+		bool useTable = switch_table(cases, table);
+		if (useTable)
+		{
+			code->write(OP_LOAD_LOCAL, switchSlot);
+			code->write(OP_SWITCH, 0);
+		}
+		uint32_t switchOp = code->count() - 1;
+
+		// create our jump table, remembering the branch of each case
+		std::vector<uint32_t> caseBranch(cases.size(), 0);
 		bool defaultCase = false;
 		for (uint32_t i = 0; i < cases.size(); i++)
 		{
@@ -241,29 +1390,25 @@ namespace Signal
 			else
 			{
 				cases[i].first->accept(*this, func); //eval the comparison expression
-				code->write(OP_REF, switchObj); //reference our switch variable
+				code->write(OP_LOAD_LOCAL, switchSlot); //reference our switch variable
 				code->write(OP_EQEQ); //compare them
-				code->write(OP_BRT, 0xBEADFEED); //branch if true to the actual code block
+				code->write(OP_BRT, 0); //branch if true to the actual code block
+				caseBranch[i] = code->count() - 1;
 			}
 		}
 		uint32_t endJmpTable = code->count();
 		code->write(OP_BR, 0);
 
-		// write each case block
-		uint32_t startBlocks = code->count();
+		// write each case block, breaks jump past all of them
+		m_contexts.push_back(JumpContext(false));
+		std::vector<uint32_t> caseAddress(cases.size(), 0);
 		uint32_t lastBlock = 0;
 		for (uint32_t i = 0; i < cases.size(); i++)
 		{
-			// find the branch for this block (will be the first one) and write this blocks address
-			for (int32_t j = startJmpTable; j < endJmpTable; j++)
-			{
-				Instruction& inst = (*code)[j];
-				if (inst.m_op == OP_BRT && inst.m_arg == 0xBEADFEED)
-				{
-					inst.m_arg = code->count();
-					break;
-				}
-			}
+			// point this case's branch at its block
+			caseAddress[i] = code->count();
+			if (cases[i].first.get() != nullptr)
+				(*code)[caseBranch[i]].m_arg = code->count();
 
 			if (cases[i].second.get() == nullptr) // fallthrough
 				continue;
@@ -280,30 +1425,122 @@ namespace Signal
 		else
 			last.m_arg = endBlocks;
 
-		// fill breaks/continues
-		for (uint32_t i = startBlocks; i < endBlocks; i++)
+		patch(func, m_contexts.back().m_breaks, endBlocks);
+		m_contexts.pop_back();
+
+		// now that the blocks are written, fill in the table
+		if (useTable)
+		{
+			table.m_default = last.m_arg;
+			for (uint32_t i = 0; i < table.m_numbers.size(); i++)
+				table.m_numbers[i] = (table.m_numbers[i] == SWITCH_NO_CASE)? table.m_default : caseAddress[table.m_numbers[i]];
+			for (auto i = table.m_strings.begin(); i != table.m_strings.end(); ++i)
+				i->second = caseAddress[i->second];
+			(*code)[switchOp].m_arg = code->add_switch(table);
+		}
+	}
+
+	// Fills the table with the index of each case when every case is a number or every case is a
+	// string, numbers also have to be whole and dense enough to index an array with.
+	// Returns false when the switch has to be compiled as a chain of tests only.
+	bool Compiler::switch_table (const std::vector<std::pair<std::shared_ptr<ASTExpression>, std::shared_ptr<ASTStatement>>>& cases, SwitchTable& table)
+	{
+		std::vector<std::pair<double_t, uint32_t>> numbers;
+		std::vector<std::pair<std::string, uint32_t>> strings;
+
+		for (uint32_t i = 0; i < cases.size(); i++)
+		{
+			if (cases[i].first.get() == nullptr)
+				continue;
+
+			std::shared_ptr<ASTExpression> value = single(cases[i].first);
+
+			if (auto number = std::dynamic_pointer_cast<ASTNumber> (value))
+				numbers.push_back(std::make_pair(number->value(), i));
+			else if (auto string = std::dynamic_pointer_cast<ASTString> (value))
+				strings.push_back(std::make_pair(string->text(), i));
+			else
+				return false;
+		}
+
+		if (strings.size() >= SWITCH_TABLE_MIN_CASES && numbers.empty())
+		{
+			// the first of two equal cases wins, like it does in the tests
+			for (uint32_t i = 0; i < strings.size(); i++)
+				table.m_strings.insert(strings[i]);
+			return true;
+		}
+
+		if (numbers.size() < SWITCH_TABLE_MIN_CASES || !strings.empty())
+			return false;
+
+		double_t low = numbers[0].first, high = numbers[0].first;
+		for (uint32_t i = 0; i < numbers.size(); i++)
 		{
-			Instruction& inst = (*code)[i];
-			if (inst.m_op == OP_BR && inst.m_arg == 0xDEADBEEF) // break, jump to end
-				inst.m_arg = endBlocks;
+			if (std::floor(numbers[i].first) != numbers[i].first)
+				return false;
+			low = std::min(low, numbers[i].first);
+			high = std::max(high, numbers[i].first);
 		}
-		return;
+
+		// at least every other entry has to be a case
+		if (high - low + 1 > 2 * numbers.size())
+			return false;
+
+		table.m_low = low;
+		table.m_numbers.assign(static_cast<uint32_t> (high - low + 1), SWITCH_NO_CASE);
+		for (uint32_t i = numbers.size(); i > 0; i--)
+			table.m_numbers[static_cast<uint32_t> (numbers[i - 1].first - low)] = numbers[i - 1].second;
+		return true;
 	}
 
 	void Compiler::visit (const ASTBreak& break_stmt, std::shared_ptr<Function> func)
 	{
-		func->code()->write(OP_BR, 0xDEADBEEF);
+		if (m_contexts.empty())
+			ThrowCompileError("Compiler : 'break' is only allowed in a loop or switch.");
+
+		func->code()->write(OP_BR, 0);
+		m_contexts.back().m_breaks.push_back(func->code()->count() - 1);
 	}
 
 	void Compiler::visit (const ASTContinue& cont_stmt, std::shared_ptr<Function> func)
 	{
-		func->code()->write(OP_BR, 0xFEEDBEAD);
+		// a switch doesn't take continues, they go to the loop around it
+		for (uint32_t i = m_contexts.size(); i > 0; i--)
+		{
+			if (m_contexts[i - 1].m_loop)
+			{
+				func->code()->write(OP_BR, 0);
+				m_contexts[i - 1].m_continues.push_back(func->code()->count() - 1);
+				return;
+			}
+		}
+
+		ThrowCompileError("Compiler : 'continue' is only allowed in a loop.");
+	}
+
+	// Points every branch on the list at address
+	void Compiler::patch (std::shared_ptr<Function> func, const PatchList& list, uint32_t address)
+	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+
+		for (uint32_t i = 0; i < list.size (); i++) {
+			(*code)[list[i]].m_arg = address;
+		}
 	}
 
 	void Compiler::visit (const ASTReturn& ret_stmt, std::shared_ptr<Function> func)
 	{
+		std::shared_ptr<CodeBlock> code = func->code ();
 		ret_stmt.ret()->accept (*this, func);
-		func->code()->write (OP_RETURN);
+
+		// return f (...) hands its frame over to f instead of returning f's result
+		if (std::dynamic_pointer_cast<ASTGFuncCall> (single (ret_stmt.ret ())) && (*code)[code->count () - 1].m_op == OP_CALL) {
+			(*code)[code->count () - 1].m_op = OP_TAILCALL;
+			return;
+		}
+
+		code->write (OP_RETURN);
 	}
 
 	void Compiler::visit (const ASTStmtExpr& expr_stmt, std::shared_ptr<Function> func)
@@ -323,26 +1560,34 @@ namespace Signal
 
 	void Compiler::visit (const ASTAssignment& expr, std::shared_ptr<Function> func)
 	{
-		if (func->scope()->find(expr.var()).get () == nullptr) {
-			func->scope()->define(expr.var(), std::shared_ptr<Object>(new Nil ()));
-		}
-
 		expr.expr()->accept (*this, func);
-		func->code ()->write (OP_SET, std::shared_ptr<Object>(new String (expr.var())));
+		store (expr.var(), func);
 	}
 
 
 	void Compiler::visit (const ASTCompare& expr, std::shared_ptr<Function> func)
 	{
+		std::shared_ptr<CodeBlock> code = func->code ();
+
+		// || and && short circuit, the right side only runs when the left side doesn't decide the result
+		if (expr.op_type () == ASTCompare::OR || expr.op_type () == ASTCompare::AND) {
+			expr.left ()->accept (*this, func);
+
+			code->write ((expr.op_type () == ASTCompare::OR)? OP_BRT_OR_POP : OP_BRF_OR_POP, 0);
+			uint32_t index = code->count () - 1;
+
+			expr.right ()->accept (*this, func);
+
+			Instruction& branch = (*code)[index];
+			branch.m_arg = code->count ();
+			return;
+		}
+
 		expr.left ()->accept (*this, func);
 		expr.right ()->accept (*this, func);
-
-		std::shared_ptr<CodeBlock> code = func->code ();
 		
 		switch (expr.op_type ())
 		{
-			case ASTCompare::OR:				  code->write (OP_OR); break;
-			case ASTCompare::AND:				  code->write (OP_AND); break;
 			case ASTCompare::EQUALS_EQUALS:		  code->write (OP_EQEQ); break;
 			case ASTCompare::NOT_EQUALS:		  code->write (OP_NEQ); break;
 			case ASTCompare::LESS_THAN:			  code->write (OP_LT); break;
@@ -357,14 +1602,25 @@ namespace Signal
 		expr.left ()->accept (*this, func);
 		expr.right ()->accept (*this, func);
 
-		std::shared_ptr<CodeBlock> code = func->code ();
-		
-		switch (expr.op_type ())
+		func->code ()->write (math_op (expr.op_type ()));
+	}
+
+	// x += y reads, changes and writes x with a single instruction
+	void Compiler::visit (const ASTCompoundAssignment& expr, std::shared_ptr<Function> func)
+	{
+		expr.expr ()->accept (*this, func);
+		update (expr.var (), math_op (expr.op_type ()), func);
+	}
+
+	OpCode Compiler::math_op (ASTBinaryMathOp::OpType type)
+	{
+		switch (type)
 		{
-			case ASTBinaryMathOp::PLUS:   code->write (OP_ADD); break;
-			case ASTBinaryMathOp::MINUS:  code->write (OP_SUB); break;
-			case ASTBinaryMathOp::TIMES:  code->write (OP_MUL); break;
-			case ASTBinaryMathOp::DIVIDE: code->write (OP_DIV); break;
+			case ASTBinaryMathOp::PLUS:   return OP_ADD;
+			case ASTBinaryMathOp::MINUS:  return OP_SUB;
+			case ASTBinaryMathOp::TIMES:  return OP_MUL;
+			case ASTBinaryMathOp::DIVIDE: return OP_DIV;
+			default:					  return OP_MOD;
 		}
 	}
 
@@ -404,16 +1660,16 @@ namespace Signal
 			ThrowCompileError("Compiler : Function '%s' expects %i arguments.", expr.name().c_str(), constructor->args().size ());
 		}
 
+		// Keep a copy of the new instance below the constructor call, and drop the constructor's result
+		func->code ()->write (OP_NEW, std::shared_ptr<Object> (new Instance (_class)));
+		func->code ()->write (OP_DUP);
+
 		for (uint32_t i = 0; i < args.size (); i++) {
 			args[i]->accept (*this, func);
 		}
 
-		auto instance = std::shared_ptr<Object>(new Instance (_class));
-
-		func->code ()->write (OP_PUSH, instance);
-		func->code ()->write (OP_PUSH, std::shared_ptr<Object> (new Number (args.size ())));
-		func->code ()->write (OP_MCALL, std::shared_ptr<Object> (new String (expr.name())));
-		func->code ()->write (OP_PUSH, instance);
+		func->code ()->write (OP_MCALL, args.size (), func->code ()->add_cache (m_env.selector (expr.name())), std::shared_ptr<Object> (new String (expr.name())));
+		func->code ()->write (OP_POP);
 	}
 
 	void Compiler::visit (const ASTGFuncCall& expr, std::shared_ptr<Function> func)
@@ -421,33 +1677,42 @@ namespace Signal
 		std::shared_ptr<CodeBlock> code = func->code ();
 		const std::vector<std::shared_ptr<ASTExpression>>& args = expr.args ();
 
-		exportedFunction efunc = m_env.findExportedFunction(expr.name());
-		if (efunc != nullptr)
+		uint32_t native;
+
+		if (m_env.findExportedFunction(expr.name(), native))
 		{
-			if (args.size () != 1) {
-				ThrowCompileError("Compiler : Call to print has more than one argument.");
-			}
+			const std::shared_ptr<Native>& callee = m_env.exported(native);
+
+			if (callee->arity () >= 0 && args.size () != callee->arity ())
+				ThrowCompileError("Compiler : Function '%s' expects %i arguments.", expr.name().c_str(), callee->arity ());
+
+			for (uint32_t i = 0; i < args.size(); i++) {
+				Object::Type type;
+
+				if (literal_type (args[i], type) && !callee->accepts (i, type))
+					ThrowCompileError("Compiler : Argument %u of '%s' has the wrong type.", i + 1, expr.name().c_str());
 
-			for (uint32_t i = 0; i < args.size(); i++)
 				args[i]->accept(*this, func);
+			}
 
-			func->code()->write (OP_PUSH, std::shared_ptr<Object>(new Number(args.size())));
-			code->write (OP_ECALL, std::shared_ptr<Object>(new String (expr.name().c_str())));
+			code->write (OP_ECALL, native, args.size(), std::shared_ptr<Object>(new String (expr.name().c_str())));
 		}
 		else
 		{
-			std::shared_ptr<Function> call_func = m_env.find_func(expr.name().c_str());
+			uint32_t index;
 
-			if (call_func == nullptr)
+			if (!m_env.find_func(expr.name(), index))
 				ThrowCompileError("Compiler : Function '%s' has not been defined.", expr.name().c_str());
 
+			std::shared_ptr<Function> call_func = m_env.func(index);
+
 			if (args.size () != call_func->args ().size())
 				ThrowCompileError("Compiler : Function '%s' expects %i arguments.", expr.name().c_str(), call_func->args().size());
 
 			for (uint32_t i = 0; i < args.size (); i++)
 				args[i]->accept(*this, func);
 
-			code->write(OP_CALL, std::shared_ptr<Object>(new String (expr.name().c_str())));
+			code->write(OP_CALL, index, std::shared_ptr<Object>(new String (expr.name().c_str())));
 		}
 	}
 
@@ -457,25 +1722,17 @@ namespace Signal
 		const std::string& base = expr.base();
 		const std::vector<std::shared_ptr<ASTExpression>>& args = expr.args ();
 
+		load (base, func);
+
 		for (uint32_t i = 0; i < args.size (); i++)
 			args[i]->accept (*this, func);
 
-		func->code ()->write (OP_REF, std::shared_ptr<Object> (new String(base)));
-		func->code ()->write (OP_PUSH, std::shared_ptr<Object> (new Number(args.size())));
-		func->code ()->write (OP_MCALL, std::shared_ptr<Object> (new String (expr.name())));
+		func->code ()->write (OP_MCALL, args.size (), func->code ()->add_cache (m_env.selector (expr.name())), std::shared_ptr<Object> (new String (expr.name())));
 	}
 
 	void Compiler::visit (const ASTIdentifier& expr, std::shared_ptr<Function> func)
 	{
-		std::shared_ptr<Object> var = func->scope ()->find (expr.name());
-
-		if (var.get () == nullptr)
-		{
-			func->scope ()->define (expr.name(), std::shared_ptr<Object> (new Nil ()));
-			var = func->scope ()->find (expr.name());
-		}
-
-		func->code ()->write (OP_REF, std::shared_ptr<Object> (new String (expr.name())));
+		load (expr.name(), func);
 	}
 
 	void Compiler::visit (const ASTNumber& num, std::shared_ptr<Function> func)
@@ -502,4 +1759,93 @@ namespace Signal
 	{
 		func->code ()->write (OP_PUSH, m_env.obj_false ());
 	}
+
+	// The parser wraps every expression in a single element expression list
+	std::shared_ptr<ASTExpression> Compiler::single (std::shared_ptr<ASTExpression> expr)
+	{
+		while (expr.get () != nullptr && expr->exprs ().size () == 1) {
+			expr = expr->exprs ()[0];
+		}
+
+		return expr;
+	}
+
+	// Whether a statement can write to the variable, either by assignment, compound assignment or ++/--
+	bool Compiler::assigns (const std::shared_ptr<ASTStatement>& stmt, const std::string& name)
+	{
+		if (stmt.get () == nullptr) {
+			return false;
+		}
+
+		if (auto block = std::dynamic_pointer_cast<ASTBlock> (stmt)) {
+			for (uint32_t i = 0; i < block->stmts ().size (); i++) {
+				if (assigns (block->stmts ()[i], name)) {
+					return true;
+				}
+			}
+		} else if (auto if_stmt = std::dynamic_pointer_cast<ASTIf> (stmt)) {
+			return assigns (if_stmt->cond (), name) || assigns (if_stmt->if_part (), name) || assigns (if_stmt->else_part (), name);
+		} else if (auto while_stmt = std::dynamic_pointer_cast<ASTWhile> (stmt)) {
+			return assigns (while_stmt->cond (), name) || assigns (while_stmt->body (), name);
+		} else if (auto for_stmt = std::dynamic_pointer_cast<ASTFor> (stmt)) {
+			return assigns (for_stmt->init (), name) || assigns (for_stmt->cond (), name) || assigns (for_stmt->inc (), name) || assigns (for_stmt->body (), name);
+		} else if (auto switch_stmt = std::dynamic_pointer_cast<ASTSwitch> (stmt)) {
+			if (assigns (switch_stmt->expr (), name)) {
+				return true;
+			}
+
+			auto cases = switch_stmt->cases ();
+			for (uint32_t i = 0; i < cases.size (); i++) {
+				if (assigns (cases[i].first, name) || assigns (cases[i].second, name)) {
+					return true;
+				}
+			}
+		} else if (auto ret_stmt = std::dynamic_pointer_cast<ASTReturn> (stmt)) {
+			return assigns (ret_stmt->ret (), name);
+		} else if (auto expr_stmt = std::dynamic_pointer_cast<ASTStmtExpr> (stmt)) {
+			return assigns (expr_stmt->expr (), name);
+		}
+
+		return false;
+	}
+
+	bool Compiler::assigns (const std::shared_ptr<ASTExpression>& expr, const std::string& name)
+	{
+		if (expr.get () == nullptr) {
+			return false;
+		}
+
+		if (auto assign = std::dynamic_pointer_cast<ASTAssignment> (expr)) {
+			return assign->var () == name || assigns (assign->expr (), name);
+		} else if (auto compound = std::dynamic_pointer_cast<ASTCompoundAssignment> (expr)) {
+			return compound->var () == name || assigns (compound->expr (), name);
+		} else if (auto compare = std::dynamic_pointer_cast<ASTCompare> (expr)) {
+			return assigns (compare->left (), name) || assigns (compare->right (), name);
+		} else if (auto math = std::dynamic_pointer_cast<ASTBinaryMathOp> (expr)) {
+			return assigns (math->left (), name) || assigns (math->right (), name);
+		} else if (auto unary = std::dynamic_pointer_cast<ASTUnaryMathOp> (expr)) {
+			auto var = std::dynamic_pointer_cast<ASTIdentifier> (unary->expr ());
+			bool writes = unary->op_type () == ASTUnaryMathOp::INCREMENT || unary->op_type () == ASTUnaryMathOp::DECREMENT;
+
+			return (writes && var.get () != nullptr && var->name () == name) || assigns (unary->expr (), name);
+		}
+
+		const std::vector<std::shared_ptr<ASTExpression>>* args = &expr->exprs ();
+
+		if (auto new_expr = std::dynamic_pointer_cast<ASTNew> (expr)) {
+			args = &new_expr->args ();
+		} else if (auto gcall = std::dynamic_pointer_cast<ASTGFuncCall> (expr)) {
+			args = &gcall->args ();
+		} else if (auto mcall = std::dynamic_pointer_cast<ASTMFuncCall> (expr)) {
+			args = &mcall->args ();
+		}
+
+		for (uint32_t i = 0; i < args->size (); i++) {
+			if (assigns ((*args)[i], name)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
 }
\ No newline at end of file
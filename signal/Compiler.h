@@ -1,22 +1,34 @@
 #pragma once
 
+#include <algorithm>
+#include <map>
+#include <sstream>
+
 #include "Enviroment.h"
 #include "Error.h"
 #include "Parser.h"
+#include "Peephole.h"
 #include "Scope.h"
 #include "VisitorInterface.h"
 
+// Marks the numbers in a switch table without a case until the table is filled in
+#define SWITCH_NO_CASE	0xFFFFFFFF
+
+// Global functions with at most this many instructions are copied into their callers, see Compiler::inline_calls
+#define INLINE_MAX_INSTRUCTIONS	20
+
 namespace Signal
 {
 	class Compiler : private VisitorInterface
 	{
 		public:
 		
-		static void Compile (Environment& env, std::shared_ptr<AST> ast);
+		// Passing false for optimize keeps the bytecode exactly as the compiler emits it, for debugging
+		static void Compile (Environment& env, std::shared_ptr<AST> ast, bool optimize = true);
 
 		private:
 
-		Compiler (Environment& env);
+		Compiler (Environment& env, bool optimize);
 
 		virtual void visit (const AST& ast);
 		virtual void visit (const ASTClassDef& class_def);
@@ -37,6 +49,7 @@ namespace Signal
 		virtual void visit (const ASTAssignment& expr, std::shared_ptr<Function> func);
 		virtual void visit (const ASTCompare& expr, std::shared_ptr<Function> func);
 		virtual void visit (const ASTBinaryMathOp& expr, std::shared_ptr<Function> func);
+		virtual void visit (const ASTCompoundAssignment& expr, std::shared_ptr<Function> func);
 		virtual void visit (const ASTUnaryMathOp& expr, std::shared_ptr<Function> func);
 		virtual void visit (const ASTNew& expr, std::shared_ptr<Function> func);
 		virtual void visit (const ASTGFuncCall& expr, std::shared_ptr<Function> func);
@@ -48,6 +61,63 @@ namespace Signal
 		virtual void visit (const ASTTrue& expr, std::shared_ptr<Function> func);
 		virtual void visit (const ASTFalse& expr, std::shared_ptr<Function> func);
 
+		void load (const std::string& name, std::shared_ptr<Function> func);
+		void store (const std::string& name, std::shared_ptr<Function> func);
+		void update (const std::string& name, OpCode op, std::shared_ptr<Function> func);
+
+		static OpCode math_op (ASTBinaryMathOp::OpType type);
+
+		// Branches to an address that isn't known yet, patched once it is
+		typedef std::vector<uint32_t> PatchList;
+
+		// The innermost loop or switch, its breaks and continues wait on these lists
+		struct JumpContext
+		{
+			JumpContext (bool loop)
+			:
+				m_loop (loop)
+			{}
+
+			bool	  m_loop;	// A switch only takes breaks
+			PatchList m_breaks;
+			PatchList m_continues;
+		};
+
+		void patch (std::shared_ptr<Function> func, const PatchList& list, uint32_t address);
+
+		bool switch_table (const std::vector<std::pair<std::shared_ptr<ASTExpression>, std::shared_ptr<ASTStatement>>>& cases, SwitchTable& table);
+
+		bool compile_numeric_for (const ASTFor& for_stmt, std::shared_ptr<Function> func);
+
+		bool inline_calls (std::shared_ptr<Function> func);
+		bool inlinable (const std::shared_ptr<Function>& func);
+
+		void size_frame (std::shared_ptr<Function> func);
+		int32_t stack_effect (const Instruction& instruction);
+
+		void specialize (std::shared_ptr<Function> func);
+		void infer_numbers (std::shared_ptr<Function> func, std::vector<std::vector<bool>>& stack, std::vector<bool>& reached);
+		void number_step (const Instruction& instruction, std::vector<bool>& locals, std::vector<bool>& stack);
+		static OpCode number_form (OpCode op);
+		static bool produces (OpCode op);
+
+		bool hoist_invariants (std::shared_ptr<Function> func);
+		bool hoist_loop (std::shared_ptr<Function> func, uint32_t head, uint32_t end, const std::vector<std::vector<bool>>& stack, const std::vector<bool>& reached);
+
+		static std::shared_ptr<ASTExpression> single (std::shared_ptr<ASTExpression> expr);
+		static bool literal_type (std::shared_ptr<ASTExpression> expr, Object::Type& type);
+		static bool assigns (const std::shared_ptr<ASTStatement>& stmt, const std::string& name);
+		static bool assigns (const std::shared_ptr<ASTExpression>& expr, const std::string& name);
+
 		Environment& m_env;
+		bool m_optimize;
+
+		std::vector<JumpContext> m_contexts;
+
+		// Global functions are created before any body is compiled, so calls can resolve to their index
+		std::map<const ASTGFuncDecl*, std::shared_ptr<Function>> m_declared;
+
+		// Every function with a body, in the order they were compiled
+		std::vector<std::shared_ptr<Function>> m_compiled;
 	};
 }
\ No newline at end of file
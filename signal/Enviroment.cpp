@@ -16,45 +16,91 @@ namespace Signal
 
 	void Environment::add_func (std::shared_ptr<Function> func)
 	{
+		// A later definition of the same name replaces the earlier one
+		m_func_index[func->name ()] = m_funcs.size ();
 		m_funcs.push_back(func);
 	}
 
 	void Environment::exportFunction(const std::string& name, exportedFunction func)
 	{
-		m_exportedFuncs.insert(std::make_pair<std::string, exportedFunction>(name, func));
+		add_native (name, std::shared_ptr<Native> (new RawNative (func)));
 	}
 
-	std::shared_ptr<Class> Environment::find_class (const std::string& name)
+	void Environment::add_native (const std::string& name, std::shared_ptr<Native> native)
 	{
-		std::shared_ptr<Class> ret;
+		m_exported_index[name] = m_exportedFuncs.size ();
+		m_exportedFuncs.push_back (native);
+	}
 
-		for (uint32_t i = 0; i < m_classes.size (); i++) {
-			if (name == m_classes[i]->name ()) {
-				ret = m_classes[i];
+	std::shared_ptr<Class> Environment::find_class (const std::string& name)
+	{
+		// Search from the back so the last definition wins
+		for (uint32_t i = m_classes.size (); i > 0; i--) {
+			if (name == m_classes[i - 1]->name ()) {
+				return m_classes[i - 1];
 			}
 		}
 
-		return ret;
+		return std::shared_ptr<Class> ();
 	}
 
 	std::shared_ptr<Function> Environment::find_func(const std::string& name)
 	{
-		std::shared_ptr<Function> ret;
+		uint32_t index;
 
-		for (uint32_t i = 0; i < m_funcs.size (); i++) {
-			if (name == m_funcs[i]->name ()) {
-				ret = m_funcs[i];
-			}
+		if (!find_func (name, index)) {
+			return std::shared_ptr<Function> ();
+		}
+
+		return m_funcs[index];
+	}
+
+	bool Environment::find_func (const std::string& name, uint32_t& index)
+	{
+		auto func = m_func_index.find (name);
+
+		if (func == m_func_index.end ()) {
+			return false;
 		}
 
-		return ret;
+		index = func->second;
+		return true;
+	}
+
+	const std::shared_ptr<Function>& Environment::func (uint32_t index) const
+	{
+		return m_funcs[index];
 	}
 
-	exportedFunction Environment::findExportedFunction(const std::string& name)
+	bool Environment::findExportedFunction(const std::string& name, uint32_t& index)
 	{
-		if (m_exportedFuncs[name])
-			return m_exportedFuncs[name];
-		return nullptr;
+		auto func = m_exported_index.find (name);
+
+		if (func == m_exported_index.end ()) {
+			return false;
+		}
+
+		index = func->second;
+		return true;
+	}
+
+	const std::shared_ptr<Native>& Environment::exported (uint32_t index) const
+	{
+		return m_exportedFuncs[index];
+	}
+
+	uint32_t Environment::selector (const std::string& name)
+	{
+		auto selector = m_selectors.find (name);
+
+		if (selector != m_selectors.end ()) {
+			return selector->second;
+		}
+
+		uint32_t id = m_selectors.size ();
+		m_selectors[name] = id;
+
+		return id;
 	}
 
 	std::shared_ptr<Object> Environment::obj_nil ()
@@ -2,13 +2,11 @@
 #include <stack>
 
 #include "Code.h"
+#include "Native.h"
 #include "Scope.h"
 
 namespace Signal
 {
-	class Environment;
-
-	typedef std::shared_ptr<Object> (*exportedFunction)(Environment env, std::vector<std::shared_ptr<Object>> args);
 	class Environment
 	{
 		public:
@@ -20,9 +18,30 @@ namespace Signal
 
 		void exportFunction(const std::string& name, exportedFunction func);
 
+		// Exports a C++ function or functor with the given signature, e.g. bind<double (double, double)> ("max", ...).
+		// The compiler checks calls against its arity and argument types. See Native::pure for pure.
+		template <typename Signature, typename F>
+		void bind (const std::string& name, F func, bool pure = false)
+		{
+			std::shared_ptr<Native> native (new typename Binding<Signature, F>::type (name, func));
+			native->set_pure (pure);
+			add_native (name, native);
+		}
+
 		std::shared_ptr<Class>    find_class (const std::string& name);
 		std::shared_ptr<Function> find_func  (const std::string& name);
-		exportedFunction findExportedFunction(const std::string& name);
+		bool find_func (const std::string& name, uint32_t& index);
+
+		// Global functions are called by their index, which stays fixed once they are added
+		const std::shared_ptr<Function>& func (uint32_t index) const;
+
+		bool findExportedFunction(const std::string& name, uint32_t& index);
+
+		// Exported functions are called by their index, which stays fixed once they are exported
+		const std::shared_ptr<Native>& exported (uint32_t index) const;
+
+		// Member function names are numbered once, every class keeps a function slot per number
+		uint32_t selector (const std::string& name);
 
 		std::shared_ptr<Object> obj_nil ();
 		std::shared_ptr<Object> obj_true ();
@@ -32,7 +51,12 @@ namespace Signal
 
 		std::vector<std::shared_ptr<Class>>	   m_classes;
 		std::vector<std::shared_ptr<Function>> m_funcs;
-		std::map<std::string, exportedFunction> m_exportedFuncs;
+		std::map<std::string, uint32_t>		   m_func_index;
+		std::map<std::string, uint32_t>		   m_selectors;
+		void add_native (const std::string& name, std::shared_ptr<Native> native);
+
+		std::vector<std::shared_ptr<Native>>   m_exportedFuncs;
+		std::map<std::string, uint32_t>		   m_exported_index;
 
 		// Built-in primitive objects
 		std::shared_ptr<Object> m_obj_nil;
@@ -4,156 +4,380 @@ namespace Signal
 {
 	Interpreter::Interpreter (Environment& env)
 	:
-		m_env (env)
+		m_env	 (env),
+		m_budget (0),
+		m_fuel	 (0),
+		m_yield	 (false),
+		m_max_depth (INTERPRETER_MAX_DEPTH),
+		m_max_stack (INTERPRETER_MAX_STACK)
 	{}
 
-	void Interpreter::execute ()
+	void Interpreter::set_budget (uint32_t budget, bool yield)
 	{
-		std::shared_ptr<Function> func = m_env.find_func ("main");
+		m_budget = budget;
+		m_yield = yield;
+	}
+
+	void Interpreter::set_limits (uint32_t max_depth, uint32_t max_stack)
+	{
+		m_max_depth = max_depth;
+		m_max_stack = max_stack;
+	}
 
-		if (func.get () == nullptr) {
-			throw Error ("Interpreter : main () does not exist.");
+	Interpreter::Status Interpreter::execute ()
+	{
+		// Only start main () when we are not resuming a script that yielded
+		if (m_frames.size () == 0) {
+			std::shared_ptr<Function> func = m_env.find_func ("main");
+
+			if (func.get () == nullptr) {
+				throw Error ("Interpreter : main () does not exist.");
+			}
+
+			push_frame (func, 0, std::shared_ptr<Instance> ());
 		}
 
-		m_frames.push (CallFrame (func));
-		m_scopes.push (func->scope ());
+		m_fuel = m_budget;
+
+		// An error ends the script, only one that yielded can be resumed
+		try {
+			return run ();
+		} catch (...) {
+			reset ();
+			throw;
+		}
+	}
 
+	Interpreter::Status Interpreter::run ()
+	{
 		while (m_frames.size () > 0) {
 			CallFrame& frame = m_frames.top ();
-			Instruction& instruction = (*frame.m_func->code ())[frame.m_address];
+			const Instruction& instruction = (*frame.m_func->code ())[frame.m_address];
+			OpCode& op = frame.m_profile->m_ops[frame.m_address];
 
 			frame.m_address++;
 
-			switch (instruction.m_op)
+			switch (op)
 			{
-				case OP_PUSH: m_stack.push (instruction.m_object); break;
-				case OP_POP:  m_stack.pop (); break;
-				case OP_NIL:  m_stack.push (m_env.obj_nil()); break;
+				case OP_PUSH: m_stack.push_back (instruction.m_object); break;
+				case OP_POP:  m_stack.pop_back (); break;
+				case OP_DUP:  m_stack.push_back (m_stack.back ()); break;
+				case OP_NIL:  m_stack.push_back (m_env.obj_nil()); break;
+
+				case OP_NEW:
+				{
+					m_stack.push_back (std::shared_ptr<Object> (new Instance (instruction.m_object->getInstance ()->_class ())));
+				}
+				break;
 
 				case OP_CALL:
 				{
-					std::shared_ptr<Function> call_func = m_env.find_func(instruction.m_object->getString()->text());
+					if (exhausted (frame)) {
+						return YIELDED;
+					}
 
-					if (call_func.get () == nullptr) {
-						throw Error ("Interpreter : function '%s' does not exist.", instruction.m_object->getString()->text());
+					const std::shared_ptr<Function>& call_func = m_env.func (instruction.m_arg);
+
+					// The arguments on top of the stack become the callee's first slots
+					push_frame (call_func, call_func->args ().size (), std::shared_ptr<Instance> ());
+				}
+				break;
+
+				case OP_TAILCALL:
+				{
+					if (exhausted (frame)) {
+						return YIELDED;
+					}
+
+					const std::shared_ptr<Function>& call_func = m_env.func (instruction.m_arg);
+					uint32_t num_args = call_func->args ().size ();
+
+					if (frame.m_base + call_func->frame_size () > m_max_stack) {
+						overflow (call_func);
 					}
 
-					m_frames.push (CallFrame(call_func));
-					call_func->scope ()->reset ();
-					m_scopes.push (std::shared_ptr<Scope> (new Scope (*call_func->scope ())));
+					// Move the arguments down over the caller's slots and restart the frame in the callee
+					std::move (m_stack.end () - num_args, m_stack.end (), m_stack.begin () + frame.m_base);
+					m_stack.resize (frame.m_base + num_args);
+					m_stack.resize (frame.m_base + call_func->locals (), m_env.obj_nil ());
+					m_loops.resize (frame.m_loops + call_func->loop_slots ());
+
+					frame.m_func = call_func;
+					frame.m_profile = &profile (call_func);
+					frame.m_profile->count ();
+
+					frame.m_instance.reset ();
+					frame.m_address = 0;
 				}
 				break;
 
 				case OP_MCALL:
 				{
-					double_t num_args = m_stack.top()->getNumber()->number();
-					m_stack.pop ();
+					if (exhausted (frame)) {
+						return YIELDED;
+					}
+
+					uint32_t num_args = instruction.m_arg;
 
-					std::shared_ptr<Object> instance = m_stack.top();
-					//m_stack.pop();
+					auto receiver = m_stack.end () - num_args - 1;
+					std::shared_ptr<Object> instance = *receiver;
 
-					Object::Type t = instance.get()->type();
 					if (instance.get()->type() != Object::INSTANCE)
 						throw Error ("Interpreter : Member call expected class instance.");
 
-					std::shared_ptr<Class> _class = dynamic_cast<Instance*>(instance.get())->_class();
-					std::shared_ptr<Function> call_func = _class->find_func(instruction.m_object->getString()->text());
+					// The frame holds on to the receiver, the arguments move down into its stack slot
+					m_stack.erase (receiver);
+
+					const std::shared_ptr<Class>& _class = static_cast<Instance*>(instance.get())->_class();
+					InlineCache& cache = frame.m_profile->m_caches[instruction.m_arg2];
+					std::shared_ptr<Function> call_func;
+
+					for (uint32_t i = 0; i < cache.m_size; i++) {
+						if (cache.m_entries[i].m_class == _class.get ()) {
+							call_func = cache.m_entries[i].m_func;
+							break;
+						}
+					}
+
 					if (call_func.get () == nullptr) {
-						throw Error ("Interpreter : Class '%s' does not define the function '%s'.", _class.get()->name().c_str(), call_func.get()->name().c_str());
+						call_func = _class->find_func(cache.m_selector);
+
+						if (call_func.get () == nullptr) {
+							throw Error ("Interpreter : Class '%s' does not define the function '%s'.", _class->name().c_str(), instruction.m_object->getString()->text().c_str());
+						}
+
+						// Sites that see more classes than the cache holds keep using the class's vtable
+						if (cache.m_size < INLINE_CACHE_ENTRIES) {
+							cache.m_entries[cache.m_size].m_class = _class.get ();
+							cache.m_entries[cache.m_size].m_func = call_func;
+							cache.m_size++;
+						}
 					}
 
-					m_frames.push (CallFrame(call_func));
-					call_func->scope()->reset();
-					call_func->scope()->setParent(_class.get()->scope());
-					m_scopes.push(call_func->scope());
+					push_frame (call_func, num_args, std::static_pointer_cast<Instance> (instance));
 				}
 				break;
 
 				case OP_RETURN:
 				{
+					// Drop the callee's slots and leave its result where the arguments were
+					std::shared_ptr<Object> result = m_stack.back ();
+
+					m_stack.resize (frame.m_base);
+					m_loops.resize (frame.m_loops);
 					m_frames.pop();
-					m_scopes.pop();
+
+					// Nothing takes main ()'s result, leave the stack empty for the next execute ()
+					if (!m_frames.empty ()) {
+						m_stack.push_back (result);
+					}
 				}
 				break;
 
 				case OP_ECALL:
 				{
-					int32_t argCount = m_stack.top()->getNumber()->number();
-					m_stack.pop();
-
-					std::vector<std::shared_ptr<Object>> args;
-					for (int i = 0; i < argCount; i++)
-					{
-						args.push_back(m_stack.top());
-						m_stack.pop();
-					}
+					// The function reads its arguments straight off the stack, its result replaces them
+					uint32_t base = m_stack.size() - instruction.m_arg2;
+					std::shared_ptr<Object> returnValue = m_env.exported(instruction.m_arg)->call(m_env, Arguments(m_stack.data() + base, instruction.m_arg2));
+					m_stack.resize(base);
 
-					exportedFunction efunc = m_env.findExportedFunction(instruction.m_object->getString()->text());
-
-					if (efunc == nullptr)
-						throw Error ("Interpreter : exported function '%s' does not exist.", instruction.m_object->getString()->text());
-					
-					std::shared_ptr<Object> returnValue = efunc(m_env, args);
 					if (returnValue != nullptr)
-						m_stack.push(returnValue);
+						m_stack.push_back(returnValue);
 					else
-						m_stack.push(m_env.obj_nil());
+						m_stack.push_back(m_env.obj_nil());
 				}
 				break;
 
-				case OP_SET:
+				case OP_STORE_MEMBER:
 				{
 					const std::string& name = instruction.m_object->getString()->text();
-					m_scopes.top()->set(name, m_stack.top());
+					frame.m_instance->scope()->set(name, m_stack.back());
 				}
 				break;
 
-				case OP_DEF:
+				case OP_LOAD_MEMBER:
 				{
 					const std::string& name = instruction.m_object->getString()->text();
-					m_scopes.top()->define(name, m_stack.top());
+					m_stack.push_back (frame.m_instance->scope()->find(name));
+				}
+				break;
+
+				case OP_LOAD_LOCAL:
+				{
+					m_stack.push_back (m_stack[frame.m_base + instruction.m_arg]);
 				}
 				break;
 
-				case OP_REF:
+				case OP_STORE_LOCAL:
+				{
+					m_stack[frame.m_base + instruction.m_arg] = m_stack.back ();
+				}
+				break;
+
+				case OP_UPDATE_MEMBER:
 				{
 					const std::string& name = instruction.m_object->getString()->text();
-					std::shared_ptr<Object> arg = m_scopes.top()->find(name);
-					m_stack.push (arg);
+					std::shared_ptr<Object> var = frame.m_instance->scope()->find(name);
+
+					// Instances of a derived class don't have the members of their base class
+					if (var.get () == nullptr) {
+						throw Error ("Scope : Variable '%s' has not been defined.", name.c_str());
+					}
+
+					update (var, static_cast<OpCode> (instruction.m_arg2), m_stack.back ());
+					frame.m_instance->scope()->set(name, var);
+					m_stack.back () = var;
+				}
+				break;
+
+				case OP_UPDATE_LOCAL:
+				{
+					std::shared_ptr<Object>& var = m_stack[frame.m_base + instruction.m_arg];
+
+					update (var, static_cast<OpCode> (instruction.m_arg2), m_stack.back ());
+					m_stack.back () = var;
 				}
 				break;
 
 				case OP_BR:
 				{
+					// Loops are the only source of backward branches
+					if (instruction.m_arg < frame.m_address) {
+						if (exhausted (frame)) {
+							return YIELDED;
+						}
+
+						frame.m_profile->count ();
+					}
+
 					frame.m_address = instruction.m_arg;
 				}
 				break;
 
 				case OP_BRT:
 				{
-					if (m_stack.top ()->type () == Object::TRUE) {
+					if (m_stack.back ()->type () == Object::TRUE) {
 						frame.m_address = instruction.m_arg;
 					}
-					m_stack.pop ();
+					m_stack.pop_back ();
 				}
 				break;
 
 				case OP_BRF:
 				{
-					if (m_stack.top ()->type () == Object::FALSE) {
+					if (m_stack.back ()->type () == Object::FALSE) {
+						frame.m_address = instruction.m_arg;
+					}
+					m_stack.pop_back ();
+				}
+				break;
+
+				case OP_BRT_OR_POP:
+				{
+					Object::Type type = m_stack.back ()->type ();
+
+					if (type == Object::TRUE) {
+						frame.m_address = instruction.m_arg;
+					} else if (type == Object::FALSE) {
+						m_stack.pop_back ();
+					} else {
+						throw Error ("Interpreter : Invalid arguments to operator '||'.");
+					}
+				}
+				break;
+
+				case OP_BRF_OR_POP:
+				{
+					Object::Type type = m_stack.back ()->type ();
+
+					if (type == Object::FALSE) {
+						frame.m_address = instruction.m_arg;
+					} else if (type == Object::TRUE) {
+						m_stack.pop_back ();
+					} else {
+						throw Error ("Interpreter : Invalid arguments to operator '&&'.");
+					}
+				}
+				break;
+
+				case OP_SWITCH:
+				{
+					// Anything but a number or string, or a type the cases aren't, is left to the == tests after this
+					SwitchTable& table = frame.m_func->code ()->switch_table (instruction.m_arg);
+					const std::shared_ptr<Object>& value = m_stack.back ();
+
+					if (value->type () == Object::NUMBER && !table.m_numbers.empty ()) {
+						frame.m_address = table.find (static_cast<Number*> (value.get ())->number ());
+					} else if (value->type () == Object::STRING && !table.m_strings.empty ()) {
+						frame.m_address = table.find (static_cast<String*> (value.get ())->text ());
+					}
+
+					m_stack.pop_back ();
+				}
+				break;
+
+				case OP_FORPREP:
+				{
+					LoopState& loop = m_loops[frame.m_loops + instruction.m_arg2];
+
+					loop.m_inclusive = m_stack.back ()->type () == Object::TRUE;
+					m_stack.pop_back ();
+
+					// The compiler always pushes the step as a number literal
+					loop.m_step = static_cast<Number*> (m_stack.back ().get ())->number ();
+					m_stack.pop_back ();
+
+					std::shared_ptr<Object> bound = m_stack.back ();
+					m_stack.pop_back ();
+
+					// The compiler only counts from a number literal, but the bound can be any local
+					if (bound->type () == Object::NUMBER) {
+						loop.m_bound = static_cast<Number*> (bound.get ())->number ();
+						loop.m_object.reset ();
+					} else {
+						loop.m_object = bound;
+					}
+
+					if (!loop.in_range (m_stack[frame.m_base + instruction.m_arg2])) {
+						frame.m_address = instruction.m_arg;
+					}
+				}
+				break;
+
+				case OP_FORLOOP:
+				{
+					if (exhausted (frame)) {
+						return YIELDED;
+					}
+
+					frame.m_profile->count ();
+
+					const LoopState& loop = m_loops[frame.m_loops + instruction.m_arg2];
+					std::shared_ptr<Object>& counter = m_stack[frame.m_base + instruction.m_arg2];
+
+					// The counter starts at a number and the loop body never assigns it, so it is still a number
+					double_t value = static_cast<Number*> (counter.get ())->number () + loop.m_step;
+
+					// Step in place unless something else holds on to the counter's current value
+					if (counter.use_count () == 1) {
+						static_cast<Number*> (counter.get ())->set (value);
+					} else {
+						counter = std::shared_ptr<Object> (new Number (value));
+					}
+
+					if (loop.in_range (counter)) {
 						frame.m_address = instruction.m_arg;
 					}
-					m_stack.pop ();
 				}
 				break;
 
 				case OP_ADD:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> right = m_stack.back ();
+					m_stack.pop_back ();
 
-					std::shared_ptr<Object> left = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> left = m_stack.back ();
+					m_stack.pop_back ();
 					
 					switch (left->type ())
 					{
@@ -163,7 +387,11 @@ namespace Signal
 							{
 								case Object::NUMBER:
 								{
-									m_stack.push (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () + dynamic_cast<Number*> (right.get ())->number ())));
+									m_stack.push_back (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () + dynamic_cast<Number*> (right.get ())->number ())));
+
+									if (frame.m_profile->is_hot ()) {
+										op = OP_QADD;
+									}
 								}
 								break;
 
@@ -182,7 +410,7 @@ namespace Signal
 							{
 								case Object::STRING:
 								{
-									m_stack.push (std::shared_ptr<Object> (new String (dynamic_cast<String*> (left.get ())->text () + dynamic_cast<String*> (right.get ())->text ())));
+									m_stack.push_back (std::shared_ptr<Object> (new String (dynamic_cast<String*> (left.get ())->text () + dynamic_cast<String*> (right.get ())->text ())));
 								}
 								break;
 
@@ -206,11 +434,11 @@ namespace Signal
 
 				case OP_SUB:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> right = m_stack.back ();
+					m_stack.pop_back ();
 
-					std::shared_ptr<Object> left = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> left = m_stack.back ();
+					m_stack.pop_back ();
 					
 					switch (left->type ())
 					{
@@ -220,7 +448,11 @@ namespace Signal
 							{
 								case Object::NUMBER:
 								{
-									m_stack.push (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () - dynamic_cast<Number*> (right.get ())->number ())));
+									m_stack.push_back (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () - dynamic_cast<Number*> (right.get ())->number ())));
+
+									if (frame.m_profile->is_hot ()) {
+										op = OP_QSUB;
+									}
 								}
 								break;
 
@@ -244,11 +476,11 @@ namespace Signal
 
 				case OP_MUL:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> right = m_stack.back ();
+					m_stack.pop_back ();
 
-					std::shared_ptr<Object> left = m_stack.top ();;
-					m_stack.pop ();
+					std::shared_ptr<Object> left = m_stack.back ();;
+					m_stack.pop_back ();
 					
 					switch (left->type ())
 					{
@@ -258,7 +490,11 @@ namespace Signal
 							{
 								case Object::NUMBER:
 								{
-									m_stack.push (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () * dynamic_cast<Number*> (right.get ())->number ())));
+									m_stack.push_back (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () * dynamic_cast<Number*> (right.get ())->number ())));
+
+									if (frame.m_profile->is_hot ()) {
+										op = OP_QMUL;
+									}
 								}
 								break;
 
@@ -282,11 +518,11 @@ namespace Signal
 
 				case OP_DIV:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> right = m_stack.back ();
+					m_stack.pop_back ();
 
-					std::shared_ptr<Object> left = m_stack.top ();;
-					m_stack.pop ();
+					std::shared_ptr<Object> left = m_stack.back ();;
+					m_stack.pop_back ();
 					
 					switch (left->type ())
 					{
@@ -297,9 +533,13 @@ namespace Signal
 								case Object::NUMBER:
 								{
 									if (dynamic_cast<Number*> (right.get ())->number () == 0) {
-										m_stack.push (std::shared_ptr<Object> (new Nil ()));
+										m_stack.push_back (std::shared_ptr<Object> (new Nil ()));
 									} else {
-										m_stack.push (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () / dynamic_cast<Number*> (right.get ())->number ())));
+										m_stack.push_back (std::shared_ptr<Object> (new Number (dynamic_cast<Number*> (left.get ())->number () / dynamic_cast<Number*> (right.get ())->number ())));
+									}
+
+									if (frame.m_profile->is_hot ()) {
+										op = OP_QDIV;
 									}
 								}
 								break;
@@ -322,16 +562,43 @@ namespace Signal
 				}
 				break;
 
+				case OP_MOD:
+				{
+					std::shared_ptr<Object> right = m_stack.back ();
+					m_stack.pop_back ();
+
+					std::shared_ptr<Object> left = m_stack.back ();
+					m_stack.pop_back ();
+
+					if (left->type () != Object::NUMBER) {
+						throw Error ("Interpreter : Invalid arguments to operator '%%'.");
+					}
+
+					if (right->type () != Object::NUMBER) {
+						throw Error ("Interpreter : Type mismatch on operator '%%'.");
+					}
+
+					// Like division, the remainder of dividing by zero is nil
+					double_t divisor = static_cast<Number*> (right.get ())->number ();
+
+					if (divisor == 0) {
+						m_stack.push_back (std::shared_ptr<Object> (new Nil ()));
+					} else {
+						push_number (left, std::fmod (static_cast<Number*> (left.get ())->number (), divisor));
+					}
+				}
+				break;
+
 				case OP_NEG:
 				{
-					std::shared_ptr<Object> value = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> value = m_stack.back ();
+					m_stack.pop_back ();
 					
 					switch (value->type())
 					{
 						case Object::NUMBER:
 						{
-							m_stack.push (std::shared_ptr<Object> (new Number (-dynamic_cast<Number*> (value.get ())->number ())));
+							m_stack.push_back (std::shared_ptr<Object> (new Number (-dynamic_cast<Number*> (value.get ())->number ())));
 						}
 						break;
 
@@ -346,7 +613,7 @@ namespace Signal
 
 				case OP_INC:
 				{
-					std::shared_ptr<Object> identifier = m_stack.top ();
+					std::shared_ptr<Object> identifier = m_stack.back ();
 					switch (identifier->type())
 					{
 						case Object::NUMBER:
@@ -366,7 +633,7 @@ namespace Signal
 				break;
 				case OP_DEC:
 				{
-					std::shared_ptr<Object> identifier = m_stack.top ();
+					std::shared_ptr<Object> identifier = m_stack.back ();
 					switch (identifier->type())
 					{
 						case Object::NUMBER:
@@ -387,20 +654,20 @@ namespace Signal
 
 				case OP_NOT:
 				{
-					std::shared_ptr<Object> value = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> value = m_stack.back ();
+					m_stack.pop_back ();
 					
 					switch (value->type ())
 					{
 						case Object::TRUE:
 						{
-							m_stack.push (std::shared_ptr<Object> (new False ()));
+							m_stack.push_back (std::shared_ptr<Object> (new False ()));
 						}
 						break;
 
 						case Object::FALSE:
 						{
-							m_stack.push (std::shared_ptr<Object> (new True ()));
+							m_stack.push_back (std::shared_ptr<Object> (new True ()));
 						}
 						break;
 
@@ -413,234 +680,505 @@ namespace Signal
 				}
 				break;
 
-				case OP_OR:
+				case OP_EQEQ:
+				{
+					std::shared_ptr<Object> right = m_stack.back();
+					m_stack.pop_back();
+
+					std::shared_ptr<Object> left = m_stack.back();
+					m_stack.pop_back();
+
+					if (frame.m_profile->is_hot () && left->type () == Object::NUMBER && right->type () == Object::NUMBER) {
+						op = OP_QEQEQ;
+					}
+
+					if (*left.get() == *right.get())
+						m_stack.push_back(std::shared_ptr<Object>(new True()));
+					else
+						m_stack.push_back(std::shared_ptr<Object>(new False()));
+				}
+				break;
+
+				case OP_NEQ:
+				{
+					std::shared_ptr<Object> right = m_stack.back ();
+					m_stack.pop_back ();
+
+					std::shared_ptr<Object> left = m_stack.back ();;
+					m_stack.pop_back ();
+
+					if (frame.m_profile->is_hot () && left->type () == Object::NUMBER && right->type () == Object::NUMBER) {
+						op = OP_QNEQ;
+					}
+
+					if (*left.get() != *right.get())
+						m_stack.push_back(std::shared_ptr<Object> (new True()));
+					else
+						m_stack.push_back(std::shared_ptr<Object> (new False()));
+				}
+				break;
+
+				case OP_LT:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> right = m_stack.back ();
+					m_stack.pop_back ();
 
-					std::shared_ptr<Object> left = m_stack.top ();;
-					m_stack.pop ();
+					std::shared_ptr<Object> left = m_stack.back ();;
+					m_stack.pop_back ();
+
+					if (frame.m_profile->is_hot () && left->type () == Object::NUMBER && right->type () == Object::NUMBER) {
+						op = OP_QLT;
+					}
 					
-					switch (left->type ())
-					{
-						case Object::TRUE:
-						{
-							switch (right->type ())
-							{
-								case Object::TRUE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new True ()));
-								}
-								break;
+					if (*left.get() < *right.get())
+						m_stack.push_back(std::shared_ptr<Object> (new True()));
+					else
+						m_stack.push_back(std::shared_ptr<Object> (new False()));
+				}
+				break;
 
-								case Object::FALSE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new True ()));
-								}
-								break;
+				case OP_GT:
+				{
+					std::shared_ptr<Object> right = m_stack.back();
+					m_stack.pop_back();
 
-								default:
-								{
-									throw Error ("Interpreter : Type mismatch on operator '||'.");
-								}
-								break;
-							}
-						}
-						break;
+					std::shared_ptr<Object> left = m_stack.back();
+					m_stack.pop_back();
 
-						case Object::FALSE:
-						{
-							switch (right->type ())
-							{
-								case Object::TRUE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new True ()));
-								}
-								break;
+					if (frame.m_profile->is_hot () && left->type () == Object::NUMBER && right->type () == Object::NUMBER) {
+						op = OP_QGT;
+					}
+					
+					if (*left.get() > *right.get())
+						m_stack.push_back(std::shared_ptr<Object> (new True()));
+					else
+						m_stack.push_back(std::shared_ptr<Object> (new False()));
+				}
+				break;
 
-								case Object::FALSE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new False ()));
-								}
-								break;
+				case OP_LTE:
+				{
+					std::shared_ptr<Object> right = m_stack.back();
+					m_stack.pop_back();
 
-								default:
-								{
-									throw Error ("Interpreter : Type mismatch on operator '||'.");
-								}
-								break;
-							}
-						}
-						break;
+					std::shared_ptr<Object> left = m_stack.back();
+					m_stack.pop_back();
 
-						default:
-						{
-							throw Error ("Interpreter : Invalid arguments to operator '||'.");
-						}
-						break;
+					if (frame.m_profile->is_hot () && left->type () == Object::NUMBER && right->type () == Object::NUMBER) {
+						op = OP_QLTE;
 					}
+					
+					if (*left.get() <= *right.get())
+						m_stack.push_back(std::shared_ptr<Object> (new True()));
+					else
+						m_stack.push_back(std::shared_ptr<Object> (new False()));
 				}
 				break;
 
-				case OP_AND:
+				case OP_GTE:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> right = m_stack.back();
+					m_stack.pop_back();
+
+					std::shared_ptr<Object> left = m_stack.back();
+					m_stack.pop_back();
 
-					std::shared_ptr<Object> left = m_stack.top ();;
-					m_stack.pop ();
+					if (frame.m_profile->is_hot () && left->type () == Object::NUMBER && right->type () == Object::NUMBER) {
+						op = OP_QGTE;
+					}
 					
-					switch (left->type ())
-					{
-						case Object::TRUE:
-						{
-							switch (right->type ())
-							{
-								case Object::TRUE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new True ()));
-								}
-								break;
+					if (*left.get() >= *right.get())
+						m_stack.push_back(std::shared_ptr<Object> (new True()));
+					else
+						m_stack.push_back(std::shared_ptr<Object> (new False()));
+				}
+				break;
 
-								case Object::FALSE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new False ()));
-								}
-								break;
+				case OP_QADD:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_ADD, left, right)) {
+						push_number (left, static_cast<Number*> (left.get ())->number () + static_cast<Number*> (right.get ())->number ());
+					}
+				}
+				break;
 
-								default:
-								{
-									throw Error ("Interpreter : Type mismatch on operator '||'.");
-								}
-								break;
-							}
+				case OP_QSUB:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_SUB, left, right)) {
+						push_number (left, static_cast<Number*> (left.get ())->number () - static_cast<Number*> (right.get ())->number ());
+					}
+				}
+				break;
+
+				case OP_QMUL:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_MUL, left, right)) {
+						push_number (left, static_cast<Number*> (left.get ())->number () * static_cast<Number*> (right.get ())->number ());
+					}
+				}
+				break;
+
+				case OP_QDIV:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_DIV, left, right)) {
+						double_t divisor = static_cast<Number*> (right.get ())->number ();
+
+						if (divisor == 0) {
+							m_stack.push_back (std::shared_ptr<Object> (new Nil ()));
+						} else {
+							push_number (left, static_cast<Number*> (left.get ())->number () / divisor);
 						}
-						break;
+					}
+				}
+				break;
 
-						case Object::FALSE:
-						{
-							switch (right->type ())
-							{
-								case Object::TRUE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new False ()));
-								}
-								break;
+				case OP_QEQEQ:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_EQEQ, left, right)) {
+						bool result = static_cast<Number*> (left.get ())->number () == static_cast<Number*> (right.get ())->number ();
+						m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
+					}
+				}
+				break;
 
-								case Object::FALSE:
-								{
-									m_stack.push (std::shared_ptr<Object> (new False ()));
-								}
-								break;
+				case OP_QNEQ:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_NEQ, left, right)) {
+						bool result = static_cast<Number*> (left.get ())->number () != static_cast<Number*> (right.get ())->number ();
+						m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
+					}
+				}
+				break;
 
-								default:
-								{
-									throw Error ("Interpreter : Type mismatch on operator '||'.");
-								}
-								break;
-							}
-						}
-						break;
+				case OP_QLT:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_LT, left, right)) {
+						bool result = static_cast<Number*> (left.get ())->number () < static_cast<Number*> (right.get ())->number ();
+						m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
+					}
+				}
+				break;
 
-						default:
-						{
-							throw Error ("Interpreter : Invalid arguments to operator '||'.");
-						}
-						break;
+				case OP_QGT:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_GT, left, right)) {
+						bool result = static_cast<Number*> (left.get ())->number () > static_cast<Number*> (right.get ())->number ();
+						m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
 					}
 				}
 				break;
 
-				case OP_EQEQ:
+				case OP_QLTE:
 				{
-					std::shared_ptr<Object> right = m_stack.top();
-					m_stack.pop();
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_LTE, left, right)) {
+						bool result = static_cast<Number*> (left.get ())->number () <= static_cast<Number*> (right.get ())->number ();
+						m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
+					}
+				}
+				break;
 
-					std::shared_ptr<Object> left = m_stack.top();
-					m_stack.pop();
+				case OP_QGTE:
+				{
+					std::shared_ptr<Object> left, right;
+					if (quick_operands (frame, op, OP_GTE, left, right)) {
+						bool result = static_cast<Number*> (left.get ())->number () >= static_cast<Number*> (right.get ())->number ();
+						m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
+					}
+				}
+				break;
 
-					if (*left.get() == *right.get())
-						m_stack.push(std::shared_ptr<Object>(new True()));
-					else
-						m_stack.push(std::shared_ptr<Object>(new False()));
+				// The compiler proved both operands are numbers
+				case OP_NADD:
+				{
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
+					push_number (left, static_cast<Number*> (left.get ())->number () + static_cast<Number*> (right.get ())->number ());
 				}
 				break;
 
-				case OP_NEQ:
+				case OP_NSUB:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
+					push_number (left, static_cast<Number*> (left.get ())->number () - static_cast<Number*> (right.get ())->number ());
+				}
+				break;
 
-					std::shared_ptr<Object> left = m_stack.top ();;
-					m_stack.pop ();
+				case OP_NMUL:
+				{
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
+					push_number (left, static_cast<Number*> (left.get ())->number () * static_cast<Number*> (right.get ())->number ());
+				}
+				break;
 
-					if (*left.get() != *right.get())
-						m_stack.push(std::shared_ptr<Object> (new True()));
-					else
-						m_stack.push(std::shared_ptr<Object> (new False()));
+				case OP_NDIV:
+				{
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
+
+					double_t divisor = static_cast<Number*> (right.get ())->number ();
+
+					if (divisor == 0) {
+						m_stack.push_back (std::shared_ptr<Object> (new Nil ()));
+					} else {
+						push_number (left, static_cast<Number*> (left.get ())->number () / divisor);
+					}
 				}
 				break;
 
-				case OP_LT:
+				case OP_NEQEQ:
 				{
-					std::shared_ptr<Object> right = m_stack.top ();
-					m_stack.pop ();
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
 
-					std::shared_ptr<Object> left = m_stack.top ();;
-					m_stack.pop ();
-					
-					if (*left.get() < *right.get())
-						m_stack.push(std::shared_ptr<Object> (new True()));
-					else
-						m_stack.push(std::shared_ptr<Object> (new False()));
+					bool result = static_cast<Number*> (left.get ())->number () == static_cast<Number*> (right.get ())->number ();
+					m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
 				}
 				break;
 
-				case OP_GT:
+				case OP_NNEQ:
 				{
-					std::shared_ptr<Object> right = m_stack.top();
-					m_stack.pop();
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
 
-					std::shared_ptr<Object> left = m_stack.top();
-					m_stack.pop();
-					
-					if (*left.get() > *right.get())
-						m_stack.push(std::shared_ptr<Object> (new True()));
-					else
-						m_stack.push(std::shared_ptr<Object> (new False()));
+					bool result = static_cast<Number*> (left.get ())->number () != static_cast<Number*> (right.get ())->number ();
+					m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
 				}
 				break;
 
-				case OP_LTE:
+				case OP_NLT:
 				{
-					std::shared_ptr<Object> right = m_stack.top();
-					m_stack.pop();
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
 
-					std::shared_ptr<Object> left = m_stack.top();
-					m_stack.pop();
-					
-					if (*left.get() <= *right.get())
-						m_stack.push(std::shared_ptr<Object> (new True()));
-					else
-						m_stack.push(std::shared_ptr<Object> (new False()));
+					bool result = static_cast<Number*> (left.get ())->number () < static_cast<Number*> (right.get ())->number ();
+					m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
 				}
 				break;
 
-				case OP_GTE:
+				case OP_NGT:
 				{
-					std::shared_ptr<Object> right = m_stack.top();
-					m_stack.pop();
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
 
-					std::shared_ptr<Object> left = m_stack.top();
-					m_stack.pop();
-					
-					if (*left.get() >= *right.get())
-						m_stack.push(std::shared_ptr<Object> (new True()));
-					else
-						m_stack.push(std::shared_ptr<Object> (new False()));
+					bool result = static_cast<Number*> (left.get ())->number () > static_cast<Number*> (right.get ())->number ();
+					m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
+				}
+				break;
+
+				case OP_NLTE:
+				{
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
+
+					bool result = static_cast<Number*> (left.get ())->number () <= static_cast<Number*> (right.get ())->number ();
+					m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
+				}
+				break;
+
+				case OP_NGTE:
+				{
+					std::shared_ptr<Object> left, right;
+					pop_operands (left, right);
+
+					bool result = static_cast<Number*> (left.get ())->number () >= static_cast<Number*> (right.get ())->number ();
+					m_stack.push_back (result ? m_env.obj_true () : m_env.obj_false ());
 				}
 				break;
 			}
 		}
+
+		return FINISHED;
+	}
+
+	void Interpreter::push_frame (std::shared_ptr<Function> func, uint32_t args, std::shared_ptr<Instance> instance)
+	{
+		if (m_frames.size () >= m_max_depth || m_stack.size () - args + func->frame_size () > m_max_stack) {
+			overflow (func);
+		}
+
+		CallFrame frame (func, profile (func), instance);
+		frame.m_profile->count ();
+		frame.m_base = m_stack.size () - args;
+		frame.m_loops = m_loops.size ();
+
+		m_stack.resize (frame.m_base + func->locals (), m_env.obj_nil ());
+		m_loops.resize (frame.m_loops + func->loop_slots ());
+		m_frames.push (frame);
+	}
+
+	Interpreter::Profile& Interpreter::profile (const std::shared_ptr<Function>& func)
+	{
+		auto found = m_profiles.find (func.get ());
+
+		if (found != m_profiles.end ()) {
+			return found->second;
+		}
+
+		Profile& profile = m_profiles[func.get ()];
+		std::shared_ptr<CodeBlock> code = func->code ();
+
+		profile.m_ops.reserve (code->count ());
+
+		for (uint32_t i = 0; i < code->count (); i++) {
+			profile.m_ops.push_back ((*code)[i].m_op);
+		}
+
+		for (uint32_t i = 0; i < code->caches (); i++) {
+			profile.m_caches.push_back (InlineCache (code->selector (i)));
+		}
+
+		return profile;
+	}
+
+	bool Interpreter::quick_operands (CallFrame& frame, OpCode& op, OpCode generic, std::shared_ptr<Object>& left, std::shared_ptr<Object>& right)
+	{
+		right = m_stack.back ();
+		m_stack.pop_back ();
+
+		if (right->type () == Object::NUMBER && m_stack.back ()->type () == Object::NUMBER) {
+			left = m_stack.back ();
+			m_stack.pop_back ();
+			return true;
+		}
+
+		// Type guard failed, deoptimize back to the generic instruction and run that instead
+		m_stack.push_back (right);
+		op = generic;
+		frame.m_address--;
+
+		return false;
+	}
+
+	void Interpreter::pop_operands (std::shared_ptr<Object>& left, std::shared_ptr<Object>& right)
+	{
+		right = std::move (m_stack.back ());
+		m_stack.pop_back ();
+
+		left = std::move (m_stack.back ());
+		m_stack.pop_back ();
+	}
+
+	// Works like the operator followed by a store. A number that only the variable holds is changed in
+	// place, anything else could be shared with another variable and gets a new object.
+	void Interpreter::update (std::shared_ptr<Object>& var, OpCode op, const std::shared_ptr<Object>& right)
+	{
+		const char* symbol;
+
+		switch (op)
+		{
+			case OP_ADD: symbol = "+="; break;
+			case OP_SUB: symbol = "-="; break;
+			case OP_MUL: symbol = "*="; break;
+			case OP_DIV: symbol = "/="; break;
+			default:	 symbol = "%="; break;
+		}
+
+		if (op == OP_ADD && var->type () == Object::STRING && right->type () == Object::STRING) {
+			var = std::shared_ptr<Object> (new String (static_cast<String*> (var.get ())->text () + static_cast<String*> (right.get ())->text ()));
+			return;
+		}
+
+		if (var->type () != Object::NUMBER) {
+			throw Error ("Interpreter : Invalid arguments to operator '%s'.", symbol);
+		}
+
+		if (right->type () != Object::NUMBER) {
+			throw Error ("Interpreter : Type mismatch on operator '%s'.", symbol);
+		}
+
+		double_t left = static_cast<Number*> (var.get ())->number ();
+		double_t value = static_cast<Number*> (right.get ())->number ();
+		double_t result;
+
+		switch (op)
+		{
+			case OP_ADD: result = left + value; break;
+			case OP_SUB: result = left - value; break;
+			case OP_MUL: result = left * value; break;
+
+			// Dividing by zero gives nil, as with / and %
+			default:
+				if (value == 0) {
+					var = std::shared_ptr<Object> (new Nil ());
+					return;
+				}
+
+				result = (op == OP_DIV)? left / value : std::fmod (left, value);
+				break;
+		}
+
+		if (var.use_count () == 1) {
+			static_cast<Number*> (var.get ())->set (result);
+		} else {
+			var = std::shared_ptr<Object> (new Number (result));
+		}
+	}
+
+	void Interpreter::push_number (std::shared_ptr<Object>& reuse, double_t number)
+	{
+		// A temporary nobody else references can be overwritten instead of allocating a new box
+		if (reuse.use_count () == 1) {
+			static_cast<Number*> (reuse.get ())->set (number);
+			m_stack.push_back (std::move (reuse));
+		} else {
+			m_stack.push_back (std::shared_ptr<Object> (new Number (number)));
+		}
+	}
+
+	bool Interpreter::exhausted (CallFrame& frame)
+	{
+		if (m_budget == 0) {
+			return false;
+		}
+
+		if (m_fuel > 0) {
+			m_fuel--;
+			return false;
+		}
+
+		if (!m_yield) {
+			throw Error ("Interpreter : Execution budget of %u exhausted.", m_budget);
+		}
+
+		// Step back so the interrupted instruction runs again when we resume
+		frame.m_address--;
+
+		return true;
+	}
+
+	void Interpreter::overflow (std::shared_ptr<Function> func)
+	{
+		// Name the innermost calls, a runaway recursion repeats the same few
+		std::string chain = func->name ();
+		uint32_t depth = m_frames.size ();
+
+		for (uint32_t i = 0; i < 8 && !m_frames.empty (); i++) {
+			chain += " <- " + m_frames.top ().m_func->name ();
+			m_frames.pop ();
+		}
+
+		if (!m_frames.empty ()) {
+			chain += " <- ...";
+		}
+
+		throw Error ("Interpreter : Stack overflow at call depth %u (%s).", depth, chain.c_str ());
+	}
+
+	void Interpreter::reset ()
+	{
+		m_frames = std::stack<CallFrame> ();
+		m_stack.clear ();
+		m_loops.clear ();
 	}
 }
\ No newline at end of file
@@ -2,46 +2,176 @@
 
 #include <iostream>
 #include <stack>
+#include <unordered_map>
 
 #include "Enviroment.h"
 
 namespace Signal
 {
+	// Default limits, see Interpreter::set_limits
+	#define INTERPRETER_MAX_DEPTH	10000
+	#define INTERPRETER_MAX_STACK	(1024 * 1024)
+
+	// Calls plus loop back-edges after which a function is considered hot
+	#define FUNCTION_HOT_THRESHOLD	1000
+
 	class Interpreter
 	{
 		public:
 
+		enum Status
+		{
+			FINISHED,	// main () has returned
+			YIELDED		// The budget ran out, calling execute () again resumes where it stopped
+		};
+
 		Interpreter (Environment& env);
 
-		void execute ();
+		Status execute ();
+
+		// Every call and every loop iteration costs one unit of budget, and each execute () gets a fresh
+		// budget. Once it runs out the interpreter yields back to the caller, or throws when yield is false.
+		// A budget of 0 means unlimited.
+		void set_budget (uint32_t budget, bool yield);
+
+		// Calls deeper than max_depth, or that would grow the stack past max_stack objects, throw an Error
+		// naming the calls that led there. Tail calls don't add depth.
+		void set_limits (uint32_t max_depth, uint32_t max_stack);
 
 		private:
 
+		// What this interpreter has seen of a function while running it. It is kept here and not in the
+		// Function, compiled code can be shared between interpreters and is only read while running.
+		struct Profile
+		{
+			Profile ()
+			:
+				m_hotness (0)
+			{}
+
+			// Counting stops at the threshold so it can't wrap around
+			void count ()
+			{
+				if (m_hotness < FUNCTION_HOT_THRESHOLD) {
+					m_hotness++;
+				}
+			}
+
+			bool is_hot () const
+			{
+				return m_hotness >= FUNCTION_HOT_THRESHOLD;
+			}
+
+			uint32_t m_hotness;	// Calls plus loop back-edges
+
+			// The function's opcodes, which the interpreter runs instead of the ones in its code so that
+			// it can quicken instructions without writing to the shared code
+			std::vector<OpCode> m_ops;
+
+			// One for each member call site in the function
+			std::vector<InlineCache> m_caches;
+		};
+
 		struct CallFrame
         {            
-			CallFrame (std::shared_ptr<Function> func)
+			CallFrame (std::shared_ptr<Function> func, Profile& profile)
 			:   
 				m_address (0),
-				m_func	  (func)
+				m_base	  (0),
+				m_loops	  (0),
+				m_func	  (func),
+				m_profile (&profile)
 			{}
 
-			CallFrame (std::shared_ptr<Function> func, std::shared_ptr<Instance> instance)
+			CallFrame (std::shared_ptr<Function> func, Profile& profile, std::shared_ptr<Instance> instance)
 			:   
 				m_address  (0),
+				m_base	   (0),
+				m_loops	   (0),
+				m_instance (instance),
 				m_func	   (func),
-				m_instance (instance)
+				m_profile  (&profile)
 			{}
 
 			uint32_t m_address;
+			uint32_t m_base;	// Where this call's slots start in m_stack, its operands follow them
+			uint32_t m_loops;
 
 			std::shared_ptr<Instance> m_instance;
 			std::shared_ptr<Function> m_func;
+			Profile*				  m_profile;
         };
 
+		Profile& profile (const std::shared_ptr<Function>& func);
+
+		// Unboxed state of a counted for loop, see OP_FORPREP
+		struct LoopState
+		{
+			double_t m_bound;
+			double_t m_step;
+			bool	 m_inclusive;
+
+			// A bound that isn't a number, the loop then compares like the generic loop would
+			std::shared_ptr<Object> m_object;
+
+			bool in_range (double_t value) const
+			{
+				if (m_step > 0) {
+					return m_inclusive ? value <= m_bound : value < m_bound;
+				}
+
+				return m_inclusive ? value >= m_bound : value > m_bound;
+			}
+
+			bool in_range (const std::shared_ptr<Object>& counter) const
+			{
+				if (m_object.get () == nullptr) {
+					return in_range (static_cast<Number*> (counter.get ())->number ());
+				}
+
+				if (m_step > 0) {
+					return m_inclusive ? *counter <= *m_object : *counter < *m_object;
+				}
+
+				return m_inclusive ? *counter >= *m_object : *counter > *m_object;
+			}
+		};
+
+		// The dispatch loop, runs until main () returns or the budget runs out
+		Status run ();
+
+		// Takes the top args values of the stack as the callee's first slots, member calls also bind their receiver
+		void push_frame (std::shared_ptr<Function> func, uint32_t args, std::shared_ptr<Instance> instance);
+
+		// Helpers for the number-specialised (quickened) instructions
+		bool quick_operands (CallFrame& frame, OpCode& op, OpCode generic, std::shared_ptr<Object>& left, std::shared_ptr<Object>& right);
+		void push_number (std::shared_ptr<Object>& reuse, double_t number);
+		void pop_operands (std::shared_ptr<Object>& left, std::shared_ptr<Object>& right);
+
+		// Applies a compound assignment's operator to a variable. The number it holds is only changed in place
+		// when nothing else refers to it, so a = b; a += 1 leaves b alone.
+		void update (std::shared_ptr<Object>& var, OpCode op, const std::shared_ptr<Object>& right);
+
+		bool exhausted (CallFrame& frame);
+		void overflow (std::shared_ptr<Function> func);
+
+		// Drop the running script so the interpreter can run again after an error
+		void reset ();
+
 		Environment& m_env;
 
+		uint32_t m_budget;
+		uint32_t m_fuel;
+		bool	 m_yield;
+
+		uint32_t m_max_depth;
+		uint32_t m_max_stack;
+
 		std::stack<CallFrame> m_frames;
-		std::stack<std::shared_ptr<Object>>	m_stack;
-		std::stack<std::shared_ptr<Scope>>	m_scopes;
+		std::vector<LoopState> m_loops;
+		std::vector<std::shared_ptr<Object>> m_stack;
+
+		// Elements of an unordered_map don't move, so frames can point at them
+		std::unordered_map<const Function*, Profile> m_profiles;
 	};
 }
\ No newline at end of file
@@ -175,7 +175,22 @@ namespace Signal
 				break;
 
 				case '^': token = Token (Token::EXPONENT); break;
-				case '%': token = Token (Token::MODULO); break;
+
+				case '%': 
+				{
+					switch (m_buffer[1]) 
+					{
+						case '=': 
+						{
+							token = Token (Token::MODULO_EQUALS); 
+							consume (); 
+						} 
+						break;
+
+						default : token = Token (Token::MODULO); break;
+					}
+				}
+				break;
 
 				case '|': 
 				{
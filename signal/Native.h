@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "Error.h"
+#include "Object.h"
+#include "Types.h"
+
+#if __cplusplus >= 201703L || (defined (_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#define SIGNAL_HAS_STRING_VIEW
+#endif
+
+namespace Signal
+{
+	class Environment;
+
+	// Read-only view of the arguments of an exported function call, they stay on the interpreter's stack
+	class Arguments
+	{
+		public:
+
+		Arguments (const std::shared_ptr<Object>* args, uint32_t count)
+		:
+			m_args	(args),
+			m_count (count)
+		{}
+
+		uint32_t size () const
+		{
+			return m_count;
+		}
+
+		const std::shared_ptr<Object>& operator[] (uint32_t i) const
+		{
+			return m_args[i];
+		}
+
+		private:
+
+		const std::shared_ptr<Object>* m_args;
+		uint32_t m_count;
+	};
+
+	typedef std::shared_ptr<Object> (*exportedFunction)(Environment& env, const Arguments& args);
+
+	// An exported function as the compiler and interpreter see it
+	class Native
+	{
+		public:
+
+		Native ()
+		:
+			m_pure (false)
+		{}
+
+		virtual ~Native () {}
+
+		// A null result is turned into nil
+		virtual std::shared_ptr<Object> call (Environment& env, const Arguments& args) = 0;
+
+		// Number of arguments the function takes, or -1 when it checks them itself
+		virtual int32_t arity () const = 0;
+		virtual bool accepts (uint32_t i, Object::Type type) const = 0;
+
+		// Whether argument i takes value without throwing, accepting its type isn't always enough as an
+		// int32_t also has to be whole and in range. A null value asks whether every value of the type does.
+		virtual bool converts (uint32_t i, const Object* value) const = 0;
+
+		// A pure function's result only depends on its arguments, it has no side effects and doesn't
+		// throw for arguments it accepts and converts. Calls to it can be moved out of loops.
+		bool pure () const
+		{
+			return m_pure;
+		}
+
+		void set_pure (bool pure)
+		{
+			m_pure = pure;
+		}
+
+		private:
+
+		bool m_pure;
+	};
+
+	// A hand-written exported function, see Environment::exportFunction
+	class RawNative : public Native
+	{
+		public:
+
+		RawNative (exportedFunction func)
+		:
+			m_func (func)
+		{}
+
+		std::shared_ptr<Object> call (Environment& env, const Arguments& args)
+		{
+			return m_func (env, args);
+		}
+
+		int32_t arity () const
+		{
+			return -1;
+		}
+
+		bool accepts (uint32_t, Object::Type) const
+		{
+			return true;
+		}
+
+		bool converts (uint32_t, const Object*) const
+		{
+			return true;
+		}
+
+		private:
+
+		exportedFunction m_func;
+	};
+
+	// Converts between objects and the C++ types bound functions take and return
+	template <typename T> struct Marshal;
+
+	template <> struct Marshal<double_t>
+	{
+		static bool accepts (Object::Type type) { return type == Object::NUMBER; }
+		static const char* name () { return "number"; }
+		static bool converts (const Object*) { return true; }
+
+		static double_t from (const std::shared_ptr<Object>& object) { return static_cast<Number*> (object.get ())->number (); }
+		static std::shared_ptr<Object> to (double_t value) { return std::shared_ptr<Object> (new Number (value)); }
+	};
+
+	template <> struct Marshal<int32_t>
+	{
+		static bool accepts (Object::Type type) { return type == Object::NUMBER; }
+		static const char* name () { return "number"; }
+
+		// Converting a fraction would truncate it, and NaN or anything out of range has no int32_t at all
+		static bool converts (const Object* object)
+		{
+			if (object == nullptr) {
+				return false;
+			}
+
+			double_t value = static_cast<const Number*> (object)->number ();
+			return value >= std::numeric_limits<int32_t>::min () && value <= std::numeric_limits<int32_t>::max () && std::floor (value) == value;
+		}
+
+		static int32_t from (const std::shared_ptr<Object>& object)
+		{
+			double_t value = static_cast<Number*> (object.get ())->number ();
+
+			if (!converts (object.get ())) {
+				throw Error ("Marshal : Expected a whole number that fits in 32 bits, got %g.", value);
+			}
+
+			return static_cast<int32_t> (value);
+		}
+
+		static std::shared_ptr<Object> to (int32_t value) { return std::shared_ptr<Object> (new Number (value)); }
+	};
+
+	template <> struct Marshal<std::string>
+	{
+		static bool accepts (Object::Type type) { return type == Object::STRING; }
+		static const char* name () { return "string"; }
+		static bool converts (const Object*) { return true; }
+
+		static const std::string& from (const std::shared_ptr<Object>& object) { return static_cast<String*> (object.get ())->text (); }
+		static std::shared_ptr<Object> to (const std::string& value) { return std::shared_ptr<Object> (new String (value)); }
+	};
+
+#ifdef SIGNAL_HAS_STRING_VIEW
+	template <> struct Marshal<std::string_view>
+	{
+		static bool accepts (Object::Type type) { return type == Object::STRING; }
+		static const char* name () { return "string"; }
+		static bool converts (const Object*) { return true; }
+
+		static std::string_view from (const std::shared_ptr<Object>& object) { return static_cast<String*> (object.get ())->text (); }
+		static std::shared_ptr<Object> to (std::string_view value) { return std::shared_ptr<Object> (new String (std::string (value))); }
+	};
+#endif
+
+	// Objects are passed through untouched
+	template <> struct Marshal<std::shared_ptr<Object>>
+	{
+		static bool accepts (Object::Type) { return true; }
+		static const char* name () { return "object"; }
+		static bool converts (const Object*) { return true; }
+
+		static const std::shared_ptr<Object>& from (const std::shared_ptr<Object>& object) { return object; }
+		static std::shared_ptr<Object> to (const std::shared_ptr<Object>& value) { return value; }
+	};
+
+	template <uint32_t... I> struct Indices {};
+	template <uint32_t N, uint32_t... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+	template <uint32_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+	template <typename R> struct Returns
+	{
+		template <typename F, typename... A>
+		static std::shared_ptr<Object> call (F& func, A&&... args)
+		{
+			return Marshal<typename std::decay<R>::type>::to (func (std::forward<A> (args)...));
+		}
+	};
+
+	template <> struct Returns<void>
+	{
+		template <typename F, typename... A>
+		static std::shared_ptr<Object> call (F& func, A&&... args)
+		{
+			func (std::forward<A> (args)...);
+			return std::shared_ptr<Object> ();
+		}
+	};
+
+	// A C++ function or functor bound with Environment::bind, arguments are unpacked straight off the stack
+	template <typename F, typename R, typename... Args>
+	class BoundNative : public Native
+	{
+		public:
+
+		BoundNative (const std::string& name, F func)
+		:
+			m_name (name),
+			m_func (func)
+		{}
+
+		std::shared_ptr<Object> call (Environment& env, const Arguments& args)
+		{
+			// The compiler checked the arity and literal arguments, anything computed is checked here
+			for (uint32_t i = 0; i < sizeof... (Args); i++) {
+				if (!accepts (i, args[i]->type ())) {
+					throw Error ("%s() : Argument %u expects a %s.", m_name.c_str (), i + 1, type_name (i));
+				}
+			}
+
+			return invoke (args, typename MakeIndices<sizeof... (Args)>::type ());
+		}
+
+		int32_t arity () const
+		{
+			return sizeof... (Args);
+		}
+
+		bool accepts (uint32_t i, Object::Type type) const
+		{
+			// The leading entry keeps the table from being empty for functions without arguments
+			static bool (*const accept[]) (Object::Type) = { nullptr, &Marshal<typename std::decay<Args>::type>::accepts... };
+			return accept[i + 1] (type);
+		}
+
+		bool converts (uint32_t i, const Object* value) const
+		{
+			static bool (*const convert[]) (const Object*) = { nullptr, &Marshal<typename std::decay<Args>::type>::converts... };
+			return convert[i + 1] (value);
+		}
+
+		private:
+
+		static const char* type_name (uint32_t i)
+		{
+			static const char* const names[] = { "", Marshal<typename std::decay<Args>::type>::name ()... };
+			return names[i + 1];
+		}
+
+		template <uint32_t... I>
+		std::shared_ptr<Object> invoke (const Arguments& args, Indices<I...>)
+		{
+			return Returns<R>::call (m_func, Marshal<typename std::decay<Args>::type>::from (args[I])...);
+		}
+
+		std::string m_name;
+		F m_func;
+	};
+
+	template <typename Signature, typename F> struct Binding;
+
+	template <typename F, typename R, typename... Args>
+	struct Binding<R (Args...), F>
+	{
+		typedef BoundNative<F, R, Args...> type;
+	};
+}
\ No newline at end of file
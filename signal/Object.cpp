@@ -221,7 +221,9 @@ namespace Signal
 	:
 		m_name  (name),
 		m_base  (base),
-		m_scope (new Scope ())
+		m_scope  (new Scope ()),
+		m_funcs  (base->m_funcs),
+		m_vtable (base->m_vtable)
 	{}
 
 	const std::string& Class::name () const
@@ -239,45 +241,59 @@ namespace Signal
 		return m_scope;
 	}
 
-	void Class::add_func(std::shared_ptr<Function> func)
+	void Class::add_func(std::shared_ptr<Function> func, uint32_t selector)
 	{
-		m_funcs.push_back(func);
+		// Overrides the inherited function of the same name
+		m_funcs[func->name ()] = func;
+
+		if (selector >= m_vtable.size ()) {
+			m_vtable.resize (selector + 1);
+		}
+
+		m_vtable[selector] = func;
 		func->scope()->setParent(this->scope());
 	}
 
 	std::shared_ptr<Function> Class::find_func (const std::string& name) const
 	{
-		std::shared_ptr<Function> ret;
+		auto func = m_funcs.find (name);
 
-		for (uint32_t i = 0; i < m_funcs.size (); i++) {
-			if (name == m_funcs[i]->name ()) {
-				ret = m_funcs[i];
-			}
+		if (func == m_funcs.end ()) {
+			return std::shared_ptr<Function> ();
 		}
 
-		if (ret.get () == nullptr) {
-			return (m_base.get () == nullptr)? std::shared_ptr<Function> () : m_base->find_func (name);
+		return func->second;
+	}
+
+	std::shared_ptr<Function> Class::find_func (uint32_t selector) const
+	{
+		if (selector >= m_vtable.size ()) {
+			return std::shared_ptr<Function> ();
 		}
 
-		return ret;
+		return m_vtable[selector];
 	}
 
 	Function::Function (const std::string& name)
 	:
-		m_name  (name),
-		m_scope (new Scope ()),
-		m_code  (new CodeBlock ())
+		m_name		(name),
+		m_loop_slots (0),
+		m_frame_size (0),
+		m_scope		(new Scope ()),
+		m_code		(new CodeBlock ())
 	{}
 
 	Function::Function (const std::string& name, const std::vector<std::string>& args)
 	:
-		m_name  (name),
-		m_args  (args),
-		m_scope (new Scope ()),
-		m_code  (new CodeBlock ())
+		m_name		(name),
+		m_args		(args),
+		m_loop_slots (0),
+		m_frame_size (0),
+		m_scope		(new Scope ()),
+		m_code		(new CodeBlock ())
 	{
 		for (uint32_t i = 0; i < m_args.size (); i++) {
-			m_scope->define (m_args[i]);
+			define_local (m_args[i]);
 		}
 	}
 
@@ -305,4 +321,57 @@ namespace Signal
 	{
 		m_scope = scope;
 	}
+
+	uint32_t Function::define_local (const std::string& name)
+	{
+		auto local = m_locals.find (name);
+
+		if (local != m_locals.end ()) {
+			return local->second;
+		}
+
+		uint32_t slot = m_locals.size ();
+		m_locals[name] = slot;
+
+		return slot;
+	}
+
+	bool Function::find_local (const std::string& name, uint32_t& slot) const
+	{
+		auto local = m_locals.find (name);
+
+		if (local == m_locals.end ()) {
+			return false;
+		}
+
+		slot = local->second;
+		return true;
+	}
+
+	uint32_t Function::locals () const
+	{
+		return m_locals.size ();
+	}
+
+	void Function::reserve_loop_slot (uint32_t slot)
+	{
+		if (slot >= m_loop_slots) {
+			m_loop_slots = slot + 1;
+		}
+	}
+
+	uint32_t Function::loop_slots () const
+	{
+		return m_loop_slots;
+	}
+
+	void Function::set_frame_size (uint32_t size)
+	{
+		m_frame_size = size;
+	}
+
+	uint32_t Function::frame_size () const
+	{
+		return m_frame_size;
+	}
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <map>
 #include <vector>
 #include <string>
 
@@ -232,9 +233,10 @@ namespace Signal
 		std::shared_ptr<Class> base () const;
 		std::shared_ptr<Scope> scope () const;
 
-		void add_func (std::shared_ptr<Function> func);
+		void add_func (std::shared_ptr<Function> func, uint32_t selector);
 
 		std::shared_ptr<Function> find_func (const std::string& name) const;
+		std::shared_ptr<Function> find_func (uint32_t selector) const;
 
 		private:
 
@@ -242,7 +244,9 @@ namespace Signal
 		std::shared_ptr<Class> m_base;
 		std::shared_ptr<Scope> m_scope;
 
-		std::vector<std::shared_ptr<Function>> m_funcs;
+		// Every function callable on the class, inherited ones included, by name and by selector
+		std::map<std::string, std::shared_ptr<Function>> m_funcs;
+		std::vector<std::shared_ptr<Function>>			 m_vtable;
 	};
 
 	class Function
@@ -259,12 +263,30 @@ namespace Signal
 
 		void set_scope (std::shared_ptr<Scope> scope);
 
+		// Locals are resolved to frame slots at compile time, arguments take the first slots.
+		uint32_t define_local (const std::string& name);
+		bool find_local (const std::string& name, uint32_t& slot) const;
+		uint32_t locals () const;
+
+		// Counted for loops keep their bound and step unboxed next to the counter's slot
+		void reserve_loop_slot (uint32_t slot);
+		uint32_t loop_slots () const;
+
+		// Stack slots a call needs, its locals plus its deepest operand stack. Set once the body is compiled.
+		void set_frame_size (uint32_t size);
+		uint32_t frame_size () const;
+
 	private:
 
 		const std::string m_name;
 		const std::vector<std::string> m_args;
 
-		// Function defines its arguments inside of the scope upon construction.
+		std::map<std::string, uint32_t> m_locals;
+
+		uint32_t m_loop_slots;
+		uint32_t m_frame_size;
+
+		// Member functions see their class through the parent of this scope.
 		std::shared_ptr<Scope>	   m_scope;
 		std::shared_ptr<CodeBlock> m_code;
 		//std::shared_ptr<ASTStatement> m_statement;
@@ -0,0 +1,361 @@
+#include <cmath>
+
+#include "Optimizer.h"
+
+namespace Signal
+{
+	std::shared_ptr<AST> Optimizer::Optimize (std::shared_ptr<AST> ast)
+	{
+		std::vector<std::shared_ptr<ASTClassDef>> class_def = ast->class_def ();
+		std::vector<std::shared_ptr<ASTFuncDecl>> func_decl;
+
+		for (uint32_t i = 0; i < ast->func_decl ().size (); i++) {
+			std::shared_ptr<ASTFuncDecl> decl = ast->func_decl ()[i];
+
+			std::string name = decl->name ();
+			std::vector<std::string> args = decl->args ();
+			std::shared_ptr<ASTStatement> body = statement (decl->body ());
+
+			if (auto member = std::dynamic_pointer_cast<ASTMFuncDecl> (decl)) {
+				std::string base = member->base ();
+				func_decl.push_back (std::shared_ptr<ASTFuncDecl> (new ASTMFuncDecl (name, base, args, body)));
+			} else {
+				func_decl.push_back (std::shared_ptr<ASTFuncDecl> (new ASTGFuncDecl (name, args, body)));
+			}
+		}
+
+		return std::shared_ptr<AST> (new AST (class_def, func_decl));
+	}
+
+	std::shared_ptr<ASTStatement> Optimizer::statement (std::shared_ptr<ASTStatement> stmt)
+	{
+		if (stmt.get () == nullptr) {
+			return stmt;
+		}
+
+		if (auto block = std::dynamic_pointer_cast<ASTBlock> (stmt)) {
+			std::vector<std::shared_ptr<ASTStatement>> stmts;
+
+			for (uint32_t i = 0; i < block->stmts ().size (); i++) {
+				stmts.push_back (statement (block->stmts ()[i]));
+			}
+
+			return std::shared_ptr<ASTStatement> (new ASTBlock (stmts));
+		}
+
+		if (auto if_stmt = std::dynamic_pointer_cast<ASTIf> (stmt)) {
+			std::shared_ptr<ASTExpression> cond = expression (if_stmt->cond ());
+			std::shared_ptr<Object> value = constant (cond);
+
+			// OP_BRF only skips the if part on false, every other constant takes it
+			if (value.get () != nullptr) {
+				if (value->type () != Object::FALSE) {
+					return statement (if_stmt->if_part ());
+				}
+
+				if (if_stmt->else_part ().get () != nullptr) {
+					return statement (if_stmt->else_part ());
+				}
+
+				std::vector<std::shared_ptr<ASTStatement>> none;
+				return std::shared_ptr<ASTStatement> (new ASTBlock (none));
+			}
+
+			if (if_stmt->else_part ().get () != nullptr) {
+				return std::shared_ptr<ASTStatement> (new ASTIf (cond, statement (if_stmt->if_part ()), statement (if_stmt->else_part ())));
+			}
+
+			return std::shared_ptr<ASTStatement> (new ASTIf (cond, statement (if_stmt->if_part ())));
+		}
+
+		if (auto while_stmt = std::dynamic_pointer_cast<ASTWhile> (stmt)) {
+			std::shared_ptr<ASTExpression> cond = expression (while_stmt->cond ());
+			std::shared_ptr<Object> value = constant (cond);
+
+			if (value.get () != nullptr && value->type () == Object::FALSE) {
+				std::vector<std::shared_ptr<ASTStatement>> none;
+				return std::shared_ptr<ASTStatement> (new ASTBlock (none));
+			}
+
+			return std::shared_ptr<ASTStatement> (new ASTWhile (cond, statement (while_stmt->body ())));
+		}
+
+		if (auto for_stmt = std::dynamic_pointer_cast<ASTFor> (stmt)) {
+			return std::shared_ptr<ASTStatement> (new ASTFor (expression (for_stmt->init ()), expression (for_stmt->cond ()), expression (for_stmt->inc ()), statement (for_stmt->body ())));
+		}
+
+		if (auto switch_stmt = std::dynamic_pointer_cast<ASTSwitch> (stmt)) {
+			std::shared_ptr<ASTSwitch> optimized (new ASTSwitch (expression (switch_stmt->expr ())));
+			auto cases = switch_stmt->cases ();
+
+			for (uint32_t i = 0; i < cases.size (); i++) {
+				optimized->addCase (cases[i].first, statement (cases[i].second));
+			}
+
+			return optimized;
+		}
+
+		if (auto ret_stmt = std::dynamic_pointer_cast<ASTReturn> (stmt)) {
+			return std::shared_ptr<ASTStatement> (new ASTReturn (expression (ret_stmt->ret ())));
+		}
+
+		if (auto expr_stmt = std::dynamic_pointer_cast<ASTStmtExpr> (stmt)) {
+			return std::shared_ptr<ASTStatement> (new ASTStmtExpr (expression (expr_stmt->expr ())));
+		}
+
+		return stmt;
+	}
+
+	std::shared_ptr<ASTExpression> Optimizer::expression (std::shared_ptr<ASTExpression> expr)
+	{
+		if (expr.get () == nullptr) {
+			return expr;
+		}
+
+		// The parser wraps expressions in lists, a list of one compiles the same as its element
+		if (expr->exprs ().size () == 1) {
+			return expression (expr->exprs ()[0]);
+		}
+
+		if (expr->exprs ().size () > 1) {
+			std::vector<std::shared_ptr<ASTExpression>> exprs = expressions (expr->exprs ());
+			return std::shared_ptr<ASTExpression> (new ASTExpression (exprs));
+		}
+
+		if (auto assignment = std::dynamic_pointer_cast<ASTAssignment> (expr)) {
+			std::string var = assignment->var ();
+			return std::shared_ptr<ASTExpression> (new ASTAssignment (var, expression (assignment->expr ())));
+		}
+
+		if (auto compound = std::dynamic_pointer_cast<ASTCompoundAssignment> (expr)) {
+			std::string var = compound->var ();
+			return std::shared_ptr<ASTExpression> (new ASTCompoundAssignment (compound->op_type (), var, expression (compound->expr ())));
+		}
+
+		if (auto cmp = std::dynamic_pointer_cast<ASTCompare> (expr)) {
+			return compare (cmp->op_type (), expression (cmp->left ()), expression (cmp->right ()));
+		}
+
+		if (auto op = std::dynamic_pointer_cast<ASTBinaryMathOp> (expr)) {
+			return math (op->op_type (), expression (op->left ()), expression (op->right ()));
+		}
+
+		if (auto op = std::dynamic_pointer_cast<ASTUnaryMathOp> (expr)) {
+			// ++ and -- change a variable, leave them alone
+			if (op->op_type () == ASTUnaryMathOp::INCREMENT || op->op_type () == ASTUnaryMathOp::DECREMENT) {
+				return expr;
+			}
+
+			std::shared_ptr<ASTExpression> operand = expression (op->expr ());
+			std::shared_ptr<Object> value = constant (operand);
+
+			if (value.get () != nullptr) {
+				if (op->op_type () == ASTUnaryMathOp::MINUS && value->type () == Object::NUMBER) {
+					return std::shared_ptr<ASTExpression> (new ASTNumber (-value->getNumber ()->number ()));
+				}
+
+				if (op->op_type () == ASTUnaryMathOp::NOT && value->type () == Object::TRUE) {
+					return std::shared_ptr<ASTExpression> (new ASTFalse ());
+				}
+
+				if (op->op_type () == ASTUnaryMathOp::NOT && value->type () == Object::FALSE) {
+					return std::shared_ptr<ASTExpression> (new ASTTrue ());
+				}
+			}
+
+			return std::shared_ptr<ASTExpression> (new ASTUnaryMathOp (op->op_type (), operand));
+		}
+
+		if (auto new_expr = std::dynamic_pointer_cast<ASTNew> (expr)) {
+			std::string name = new_expr->name ();
+			std::vector<std::shared_ptr<ASTExpression>> args = expressions (new_expr->args ());
+			return std::shared_ptr<ASTExpression> (new ASTNew (name, args));
+		}
+
+		if (auto call = std::dynamic_pointer_cast<ASTGFuncCall> (expr)) {
+			std::string name = call->name ();
+			std::vector<std::shared_ptr<ASTExpression>> args = expressions (call->args ());
+			return std::shared_ptr<ASTExpression> (new ASTGFuncCall (name, args));
+		}
+
+		if (auto call = std::dynamic_pointer_cast<ASTMFuncCall> (expr)) {
+			std::string name = call->name ();
+			std::string base = call->base ();
+			std::vector<std::shared_ptr<ASTExpression>> args = expressions (call->args ());
+			return std::shared_ptr<ASTExpression> (new ASTMFuncCall (name, base, args));
+		}
+
+		return expr;
+	}
+
+	std::vector<std::shared_ptr<ASTExpression>> Optimizer::expressions (const std::vector<std::shared_ptr<ASTExpression>>& exprs)
+	{
+		std::vector<std::shared_ptr<ASTExpression>> optimized;
+
+		for (uint32_t i = 0; i < exprs.size (); i++) {
+			optimized.push_back (expression (exprs[i]));
+		}
+
+		return optimized;
+	}
+
+	std::shared_ptr<ASTExpression> Optimizer::compare (ASTCompare::OpType op, std::shared_ptr<ASTExpression> left, std::shared_ptr<ASTExpression> right)
+	{
+		std::shared_ptr<Object> lhs = constant (left);
+		std::shared_ptr<Object> rhs = constant (right);
+
+		// || and && give the left side when it decides the result and the right side otherwise, see OP_BRT_OR_POP.
+		// Any other left side has to keep failing at runtime.
+		bool boolean = lhs.get () != nullptr && (lhs->type () == Object::TRUE || lhs->type () == Object::FALSE);
+
+		if (op == ASTCompare::OR && boolean) {
+			return (lhs->type () == Object::TRUE)? left : right;
+		}
+
+		if (op == ASTCompare::AND && boolean) {
+			return (lhs->type () == Object::FALSE)? left : right;
+		}
+
+		if (lhs.get () != nullptr && rhs.get () != nullptr) {
+			try {
+				bool result;
+
+				switch (op)
+				{
+					case ASTCompare::EQUALS_EQUALS:		  result = *lhs == *rhs; break;
+					case ASTCompare::NOT_EQUALS:		  result = *lhs != *rhs; break;
+					case ASTCompare::LESS_THAN:			  result = *lhs <  *rhs; break;
+					case ASTCompare::GREATER_THAN:		  result = *lhs >  *rhs; break;
+					case ASTCompare::LESS_THAN_EQUALS:	  result = *lhs <= *rhs; break;
+					case ASTCompare::GREATER_THAN_EQUALS: result = *lhs >= *rhs; break;
+					default: return std::shared_ptr<ASTExpression> (new ASTCompare (op, left, right));
+				}
+
+				if (result) {
+					return std::shared_ptr<ASTExpression> (new ASTTrue ());
+				}
+
+				return std::shared_ptr<ASTExpression> (new ASTFalse ());
+			} catch (Error&) {
+				// The objects can't be compared, keep the comparison so the error is raised at runtime
+			}
+		}
+
+		return std::shared_ptr<ASTExpression> (new ASTCompare (op, left, right));
+	}
+
+	std::shared_ptr<ASTExpression> Optimizer::math (ASTBinaryMathOp::OpType op, std::shared_ptr<ASTExpression> left, std::shared_ptr<ASTExpression> right)
+	{
+		std::shared_ptr<Object> lhs = constant (left);
+		std::shared_ptr<Object> rhs = constant (right);
+
+		if (lhs.get () != nullptr && rhs.get () != nullptr) {
+			if (lhs->type () == Object::NUMBER && rhs->type () == Object::NUMBER) {
+				double_t a = lhs->getNumber ()->number ();
+				double_t b = rhs->getNumber ()->number ();
+
+				switch (op)
+				{
+					case ASTBinaryMathOp::PLUS:	  return std::shared_ptr<ASTExpression> (new ASTNumber (a + b));
+					case ASTBinaryMathOp::MINUS:  return std::shared_ptr<ASTExpression> (new ASTNumber (a - b));
+					case ASTBinaryMathOp::TIMES:  return std::shared_ptr<ASTExpression> (new ASTNumber (a * b));
+
+					// Dividing by zero gives nil at runtime, which has no literal worth folding to
+					case ASTBinaryMathOp::DIVIDE:
+						if (b != 0) {
+							return std::shared_ptr<ASTExpression> (new ASTNumber (a / b));
+						}
+						break;
+
+					case ASTBinaryMathOp::MODULO:
+						if (b != 0) {
+							return std::shared_ptr<ASTExpression> (new ASTNumber (std::fmod (a, b)));
+						}
+						break;
+				}
+			}
+
+			if (op == ASTBinaryMathOp::PLUS && lhs->type () == Object::STRING && rhs->type () == Object::STRING) {
+				std::string text = lhs->getString ()->text () + rhs->getString ()->text ();
+				return std::shared_ptr<ASTExpression> (new ASTString (text));
+			}
+		}
+
+		// Identities only hold for numbers, "a" + 0 has to keep failing at runtime
+		switch (op)
+		{
+			case ASTBinaryMathOp::PLUS:
+				if (is_number (left) && is_number (right, 0)) return left;
+				if (is_number (left, 0) && is_number (right)) return right;
+				break;
+
+			case ASTBinaryMathOp::MINUS:
+				if (is_number (left) && is_number (right, 0)) return left;
+				break;
+
+			case ASTBinaryMathOp::TIMES:
+				if (is_number (left) && is_number (right, 1)) return left;
+				if (is_number (left, 1) && is_number (right)) return right;
+				break;
+
+			case ASTBinaryMathOp::DIVIDE:
+				if (is_number (left) && is_number (right, 1)) return left;
+				break;
+		}
+
+		return std::shared_ptr<ASTExpression> (new ASTBinaryMathOp (op, left, right));
+	}
+
+	std::shared_ptr<Object> Optimizer::constant (std::shared_ptr<ASTExpression> expr)
+	{
+		if (auto num = std::dynamic_pointer_cast<ASTNumber> (expr)) {
+			return std::shared_ptr<Object> (new Number (num->value ()));
+		} else if (auto str = std::dynamic_pointer_cast<ASTString> (expr)) {
+			return std::shared_ptr<Object> (new String (str->text ()));
+		} else if (std::dynamic_pointer_cast<ASTTrue> (expr)) {
+			return std::shared_ptr<Object> (new True ());
+		} else if (std::dynamic_pointer_cast<ASTFalse> (expr)) {
+			return std::shared_ptr<Object> (new False ());
+		} else if (std::dynamic_pointer_cast<ASTNil> (expr)) {
+			return std::shared_ptr<Object> (new Nil ());
+		}
+
+		return std::shared_ptr<Object> ();
+	}
+
+	// Whether an expression gives a number whenever it doesn't raise an error
+	bool Optimizer::is_number (std::shared_ptr<ASTExpression> expr)
+	{
+		if (std::dynamic_pointer_cast<ASTNumber> (expr)) {
+			return true;
+		}
+
+		// - and * only accept numbers, while / gives nil on division by zero and + also joins strings
+		if (auto op = std::dynamic_pointer_cast<ASTBinaryMathOp> (expr)) {
+			switch (op->op_type ())
+			{
+				case ASTBinaryMathOp::MINUS:
+				case ASTBinaryMathOp::TIMES:
+					return true;
+
+				case ASTBinaryMathOp::PLUS:
+					return is_number (op->left ()) && is_number (op->right ());
+
+				default:
+					return false;
+			}
+		}
+
+		if (auto op = std::dynamic_pointer_cast<ASTUnaryMathOp> (expr)) {
+			return op->op_type () == ASTUnaryMathOp::MINUS;
+		}
+
+		return false;
+	}
+
+	bool Optimizer::is_number (std::shared_ptr<ASTExpression> expr, double_t value)
+	{
+		auto num = std::dynamic_pointer_cast<ASTNumber> (expr);
+		return num.get () != nullptr && num->value () == value;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "AST.h"
+#include "Object.h"
+
+namespace Signal
+{
+	// Rewrites a parsed program before it is compiled. Constant subexpressions are folded with the same
+	// operators the interpreter uses, arithmetic identities are dropped where the operand is known to be a
+	// number, and if/while statements on constant conditions are resolved. Anything that might behave
+	// differently at runtime is left as written.
+	class Optimizer
+	{
+		public:
+
+		static std::shared_ptr<AST> Optimize (std::shared_ptr<AST> ast);
+
+		private:
+
+		static std::shared_ptr<ASTStatement>  statement  (std::shared_ptr<ASTStatement> stmt);
+		static std::shared_ptr<ASTExpression> expression (std::shared_ptr<ASTExpression> expr);
+		static std::vector<std::shared_ptr<ASTExpression>> expressions (const std::vector<std::shared_ptr<ASTExpression>>& exprs);
+
+		static std::shared_ptr<ASTExpression> compare (ASTCompare::OpType op, std::shared_ptr<ASTExpression> left, std::shared_ptr<ASTExpression> right);
+		static std::shared_ptr<ASTExpression> math (ASTBinaryMathOp::OpType op, std::shared_ptr<ASTExpression> left, std::shared_ptr<ASTExpression> right);
+
+		// The object a literal compiles to, or null for anything that isn't a literal
+		static std::shared_ptr<Object> constant (std::shared_ptr<ASTExpression> expr);
+
+		static bool is_number (std::shared_ptr<ASTExpression> expr);
+		static bool is_number (std::shared_ptr<ASTExpression> expr, double_t value);
+	};
+}
\ No newline at end of file
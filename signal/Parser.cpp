@@ -355,19 +355,32 @@ namespace Signal
 	}
 
 	// Handles <lvalue> "=" <expression>
+	//		   <lvalue> "+=" <expression>, and the same for -=, *=, /= and %=
 	std::shared_ptr<ASTExpression> Parser::do_expr1 ()
 	{
 		std::shared_ptr<ASTExpression> expr = do_expr2 ();
 
-		while (match (Token::EQUALS)) {
+		while (match (Token::EQUALS) || match (Token::PLUS_EQUALS) || match (Token::MINUS_EQUALS) || 
+			   match (Token::TIMES_EQUALS) || match (Token::DIVIDE_EQUALS) || match (Token::MODULO_EQUALS)) {
 			if (expr->type () != ASTExpression::IDENTIFIER) {
 				ThrowSignalError(m_lexer.line (), m_lexer.character (), "Parser : left side of an assignment must be an lvalue.");
 			}
 
+			Token::Type op = m_buffer[0].type ();
+			std::string name = dynamic_cast<ASTIdentifier*>(expr.get ())->name ();
+
 			consume();
 			std::shared_ptr<ASTExpression> expr_right = do_expr1 ();
 
-			expr = std::shared_ptr<ASTExpression> (new ASTAssignment (dynamic_cast<ASTIdentifier*>(expr.get ())->name (), expr_right));
+			switch (op)
+			{
+				case Token::PLUS_EQUALS:   expr = std::shared_ptr<ASTExpression> (new ASTCompoundAssignment (ASTBinaryMathOp::PLUS, name, expr_right)); break;
+				case Token::MINUS_EQUALS:  expr = std::shared_ptr<ASTExpression> (new ASTCompoundAssignment (ASTBinaryMathOp::MINUS, name, expr_right)); break;
+				case Token::TIMES_EQUALS:  expr = std::shared_ptr<ASTExpression> (new ASTCompoundAssignment (ASTBinaryMathOp::TIMES, name, expr_right)); break;
+				case Token::DIVIDE_EQUALS: expr = std::shared_ptr<ASTExpression> (new ASTCompoundAssignment (ASTBinaryMathOp::DIVIDE, name, expr_right)); break;
+				case Token::MODULO_EQUALS: expr = std::shared_ptr<ASTExpression> (new ASTCompoundAssignment (ASTBinaryMathOp::MODULO, name, expr_right)); break;
+				default:				   expr = std::shared_ptr<ASTExpression> (new ASTAssignment (name, expr_right)); break;
+			}
 		}
 
 		return expr;
@@ -513,11 +526,12 @@ namespace Signal
 
 	// Handles <expression> "*" <expression>
 	//		   <expression> "/" <expression>
+	//		   <expression> "%" <expression>
 	std::shared_ptr<ASTExpression> Parser::do_expr7 ()
 	{
 		std::shared_ptr<ASTExpression> expr = do_expr8 ();
 
-		while (match (Token::TIMES) || match (Token::DIVIDE)) {
+		while (match (Token::TIMES) || match (Token::DIVIDE) || match (Token::MODULO)) {
 			switch (m_buffer[0].type ())
 			{
 				case Token::TIMES:
@@ -535,6 +549,14 @@ namespace Signal
 					expr = std::shared_ptr<ASTExpression> (new ASTBinaryMathOp (ASTBinaryMathOp::DIVIDE, expr, expr_right));
 				}
 				break;
+
+				case Token::MODULO:
+				{
+					consume ();
+					std::shared_ptr<ASTExpression> expr_right = do_expr8 ();
+					expr = std::shared_ptr<ASTExpression> (new ASTBinaryMathOp (ASTBinaryMathOp::MODULO, expr, expr_right));
+				}
+				break;
 			}
 		}
 
@@ -0,0 +1,440 @@
+#include <algorithm>
+
+#include "Peephole.h"
+#include "Object.h"
+
+namespace Signal
+{
+	void Peephole::Optimize (CodeBlock& code)
+	{
+		bool changed = true;
+
+		// Removing code can leave new branches to branches behind and threading can leave new dead code
+		while (changed) {
+			changed = thread (code);
+
+			std::vector<bool> removed (code.count (), false);
+
+			if (unreachable (code, removed) | unused_stores (code, removed)) {
+				compact (code, removed);
+				changed = true;
+			}
+
+			removed.assign (code.count (), false);
+
+			if (simplify (code, removed)) {
+				compact (code, removed);
+				changed = true;
+			}
+		}
+	}
+
+	// Splits the code into basic blocks, a new block starts at every branch target and after every
+	// instruction that branches or returns
+	void Peephole::flow_graph (CodeBlock& code, std::vector<Block>& blocks)
+	{
+		uint32_t count = code.count ();
+		std::vector<bool> leader (count + 1, false);
+		std::vector<uint32_t> block_of (count + 1);
+
+		leader[0] = true;
+
+		for (uint32_t i = 0; i < count; i++) {
+			if (is_branch (code[i]) && code[i].m_arg < count) {
+				leader[code[i].m_arg] = true;
+			}
+
+			if (code[i].m_op == OP_SWITCH) {
+				code.switch_table (code[i].m_arg).each_target ([&] (uint32_t& target) {
+					leader[std::min (target, count)] = true;
+				});
+			}
+
+			if (is_branch (code[i]) || code[i].m_op == OP_SWITCH || ends_block (code[i])) {
+				leader[i + 1] = true;
+			}
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			if (leader[i]) {
+				Block block;
+				block.m_start = i;
+				blocks.push_back (block);
+			}
+
+			block_of[i] = blocks.size () - 1;
+			blocks.back ().m_end = i + 1;
+		}
+
+		for (uint32_t i = 0; i < blocks.size (); i++) {
+			Block& block = blocks[i];
+			const Instruction& last = code[block.m_end - 1];
+
+			// Branches out of the code and falling off the end go nowhere
+			if (is_branch (last) && last.m_arg < count) {
+				block.m_next.push_back (block_of[last.m_arg]);
+			}
+
+			if (last.m_op == OP_SWITCH) {
+				code.switch_table (last.m_arg).each_target ([&] (uint32_t& target) {
+					if (target < count) {
+						block.m_next.push_back (block_of[target]);
+					}
+				});
+			}
+
+			if (!ends_block (last) && block.m_end < count) {
+				block.m_next.push_back (block_of[block.m_end]);
+			}
+		}
+	}
+
+	// Removes the blocks control can't get to from the start of the function
+	bool Peephole::unreachable (CodeBlock& code, std::vector<bool>& removed)
+	{
+		std::vector<Block> blocks;
+		flow_graph (code, blocks);
+
+		if (blocks.empty ()) {
+			return false;
+		}
+
+		std::vector<bool> reached (blocks.size (), false);
+		std::vector<uint32_t> work (1, 0);
+		bool changed = false;
+
+		reached[0] = true;
+
+		while (!work.empty ()) {
+			const Block& block = blocks[work.back ()];
+			work.pop_back ();
+
+			for (uint32_t i = 0; i < block.m_next.size (); i++) {
+				if (!reached[block.m_next[i]]) {
+					reached[block.m_next[i]] = true;
+					work.push_back (block.m_next[i]);
+				}
+			}
+		}
+
+		for (uint32_t i = 0; i < blocks.size (); i++) {
+			if (reached[i]) {
+				continue;
+			}
+
+			for (uint32_t j = blocks[i].m_start; j < blocks[i].m_end; j++) {
+				removed[j] = true;
+			}
+
+			changed = true;
+		}
+
+		return changed;
+	}
+
+	// Removes stores to locals nothing ever loads. A store leaves its value on the stack, so the
+	// expression still runs and whatever used the value still gets it.
+	bool Peephole::unused_stores (CodeBlock& code, std::vector<bool>& removed)
+	{
+		std::vector<bool> read;
+		bool changed = false;
+
+		for (uint32_t i = 0; i < code.count (); i++) {
+			const Instruction& instruction = code[i];
+			uint32_t slot;
+
+			switch (instruction.m_op)
+			{
+				case OP_LOAD_LOCAL:
+				case OP_UPDATE_LOCAL: slot = instruction.m_arg; break;
+				case OP_FORPREP:
+				case OP_FORLOOP: slot = instruction.m_arg2; break;
+				default: continue;
+			}
+
+			if (slot >= read.size ()) {
+				read.resize (slot + 1, false);
+			}
+
+			read[slot] = true;
+		}
+
+		for (uint32_t i = 0; i < code.count (); i++) {
+			const Instruction& instruction = code[i];
+
+			if (instruction.m_op == OP_STORE_LOCAL && (instruction.m_arg >= read.size () || !read[instruction.m_arg])) {
+				removed[i] = true;
+				changed = true;
+			}
+		}
+
+		return changed;
+	}
+
+	bool Peephole::thread (CodeBlock& code)
+	{
+		bool changed = false;
+
+		for (uint32_t i = 0; i < code.count (); i++) {
+			Instruction& instruction = code[i];
+			uint32_t target;
+
+			switch (instruction.m_op)
+			{
+				case OP_BR:
+				case OP_FORLOOP:
+					target = follow (code, instruction.m_arg, OP_BR);
+					break;
+
+				// A || b || c branches from one OP_BRT_OR_POP to the next with the same value on the stack
+				case OP_BRT_OR_POP:
+				case OP_BRF_OR_POP:
+					target = follow (code, instruction.m_arg, instruction.m_op);
+					break;
+
+				case OP_BRT:
+				case OP_BRF:
+				case OP_FORPREP:
+					target = follow (code, instruction.m_arg, OP_BR);
+					break;
+
+				case OP_SWITCH:
+					code.switch_table (instruction.m_arg).each_target ([&] (uint32_t& address) {
+						uint32_t target = follow (code, address, OP_BR);
+
+						if (target > i && target != address) {
+							address = target;
+							changed = true;
+						}
+					});
+					continue;
+
+				default:
+					continue;
+			}
+
+			// Only OP_BR and OP_FORLOOP charge the budget, so they are the only ones that may branch backwards
+			if (target <= i && instruction.m_op != OP_BR && instruction.m_op != OP_FORLOOP) {
+				continue;
+			}
+
+			if (target != instruction.m_arg) {
+				instruction.m_arg = target;
+				changed = true;
+			}
+		}
+
+		return changed;
+	}
+
+	bool Peephole::simplify (CodeBlock& code, std::vector<bool>& removed)
+	{
+		uint32_t count = code.count ();
+		std::vector<bool> targeted (count + 1, false);
+		bool changed = false;
+
+		for (uint32_t i = 0; i < count; i++) {
+			if (is_branch (code[i]) && code[i].m_arg <= count) {
+				targeted[code[i].m_arg] = true;
+			}
+
+			if (code[i].m_op == OP_SWITCH) {
+				code.switch_table (code[i].m_arg).each_target ([&] (uint32_t& target) {
+					targeted[std::min (target, count)] = true;
+				});
+			}
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			Instruction& instruction = code[i];
+
+			if (i + 1 >= count || targeted[i + 1]) {
+				continue;
+			}
+
+			const Instruction& next = code[i + 1];
+
+			// if (x) break;  branches over a branch, branch on the opposite instead while it stays forward
+			if ((instruction.m_op == OP_BRT || instruction.m_op == OP_BRF) && instruction.m_arg == i + 2 &&
+				next.m_op == OP_BR && next.m_arg > i) {
+				instruction.m_op = (instruction.m_op == OP_BRT)? OP_BRF : OP_BRT;
+				instruction.m_arg = next.m_arg;
+				removed[i + 1] = true;
+				changed = true;
+				i++;
+				continue;
+			}
+
+			// while (true)  tests a constant, the branch is either always or never taken
+			if (instruction.m_op == OP_PUSH && (next.m_op == OP_BRT || next.m_op == OP_BRF)) {
+				Object::Type taken = (next.m_op == OP_BRT)? Object::TRUE : Object::FALSE;
+
+				if (instruction.m_object->type () == taken) {
+					instruction = Instruction (OP_BR, next.m_arg);
+				} else {
+					removed[i] = true;
+				}
+
+				removed[i + 1] = true;
+				changed = true;
+				i++;
+				continue;
+			}
+
+			// x; pop
+			if (is_push (instruction) && next.m_op == OP_POP) {
+				removed[i] = removed[i + 1] = true;
+				changed = true;
+				i++;
+				continue;
+			}
+
+			if (i + 2 >= count || targeted[i + 2] || next.m_op != OP_POP) {
+				continue;
+			}
+
+			const Instruction& load = code[i + 2];
+
+			// a = x; a  keeps x on the stack instead of popping it and loading it again, the same goes for a += x; a
+			if (((instruction.m_op == OP_STORE_LOCAL || instruction.m_op == OP_UPDATE_LOCAL) && load.m_op == OP_LOAD_LOCAL && instruction.m_arg == load.m_arg) ||
+				((instruction.m_op == OP_STORE_MEMBER || instruction.m_op == OP_UPDATE_MEMBER) && load.m_op == OP_LOAD_MEMBER && same_name (instruction, load))) {
+				removed[i + 1] = removed[i + 2] = true;
+				changed = true;
+				i += 2;
+			}
+		}
+
+		// A branch to the instruction after it does nothing once the code in between is gone
+		for (uint32_t i = 0; i < count; i++) {
+			if (removed[i] || code[i].m_op != OP_BR || code[i].m_arg <= i) {
+				continue;
+			}
+
+			uint32_t next = i + 1;
+			while (next < count && removed[next]) {
+				next++;
+			}
+
+			if (code[i].m_arg == next) {
+				removed[i] = true;
+				changed = true;
+			}
+		}
+
+		return changed;
+	}
+
+	void Peephole::compact (CodeBlock& code, const std::vector<bool>& removed)
+	{
+		uint32_t count = code.count ();
+
+		// Where each old address ends up, a removed instruction maps to the next one that's kept
+		std::vector<uint32_t> address (count + 1);
+		uint32_t kept = 0;
+
+		for (uint32_t i = 0; i < count; i++) {
+			address[i] = kept;
+
+			if (!removed[i]) {
+				kept++;
+			}
+		}
+
+		address[count] = kept;
+
+		std::vector<Instruction> instructions;
+		instructions.reserve (kept);
+
+		for (uint32_t i = 0; i < count; i++) {
+			if (removed[i]) {
+				continue;
+			}
+
+			instructions.push_back (code[i]);
+			Instruction& instruction = instructions.back ();
+
+			if (is_branch (instruction) && instruction.m_arg <= count) {
+				instruction.m_arg = address[instruction.m_arg];
+			}
+
+			if (instruction.m_op == OP_SWITCH) {
+				code.switch_table (instruction.m_arg).each_target ([&] (uint32_t& target) {
+					target = address[std::min (target, count)];
+				});
+			}
+		}
+
+		code.swap (instructions);
+	}
+
+	// Where a branch to target ends up after passing through unconditional branches, and through branches
+	// with the op also that are taken in the same case
+	uint32_t Peephole::follow (CodeBlock& code, uint32_t target, OpCode also)
+	{
+		uint32_t at = target;
+
+		for (uint32_t hops = 0; at < code.count () && (code[at].m_op == OP_BR || code[at].m_op == also); hops++) {
+			// Branches going around in a circle, leave them be
+			if (hops == code.count ()) {
+				return target;
+			}
+
+			at = code[at].m_arg;
+		}
+
+		return at;
+	}
+
+	bool Peephole::is_branch (const Instruction& instruction)
+	{
+		switch (instruction.m_op)
+		{
+			case OP_BR:
+			case OP_BRT:
+			case OP_BRF:
+			case OP_BRT_OR_POP:
+			case OP_BRF_OR_POP:
+			case OP_FORPREP:
+			case OP_FORLOOP:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	// Instructions that push a value and do nothing else
+	bool Peephole::is_push (const Instruction& instruction)
+	{
+		switch (instruction.m_op)
+		{
+			case OP_PUSH:
+			case OP_NIL:
+			case OP_DUP:
+			case OP_LOAD_LOCAL:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	bool Peephole::ends_block (const Instruction& instruction)
+	{
+		switch (instruction.m_op)
+		{
+			case OP_BR:
+			case OP_RETURN:
+			case OP_TAILCALL:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	bool Peephole::same_name (const Instruction& left, const Instruction& right)
+	{
+		return static_cast<String*> (left.m_object.get ())->text () == static_cast<String*> (right.m_object.get ())->text ();
+	}
+}
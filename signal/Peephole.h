@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "Code.h"
+
+namespace Signal
+{
+	// Cleans up the bytecode of a compiled function. Branches to branches are threaded to where they end
+	// up, stores that are loaded again straight away keep their value on the stack, values pushed only to
+	// be popped are dropped, and blocks the control flow graph can't reach and stores to locals that are
+	// never loaded are removed.
+	class Peephole
+	{
+		public:
+
+		static void Optimize (CodeBlock& code);
+
+		// Instructions whose arg is an address in the code
+		static bool is_branch (const Instruction& instruction);
+
+		// Instructions that never carry on to the next one
+		static bool ends_block (const Instruction& instruction);
+
+		private:
+
+		// A straight run of instructions [m_start, m_end) and the blocks control can go to after it
+		struct Block
+		{
+			uint32_t m_start;
+			uint32_t m_end;
+			std::vector<uint32_t> m_next;
+		};
+
+		static void flow_graph (CodeBlock& code, std::vector<Block>& blocks);
+
+		static bool unreachable (CodeBlock& code, std::vector<bool>& removed);
+		static bool unused_stores (CodeBlock& code, std::vector<bool>& removed);
+		static bool thread (CodeBlock& code);
+		static bool simplify (CodeBlock& code, std::vector<bool>& removed);
+		static void compact (CodeBlock& code, const std::vector<bool>& removed);
+
+		static uint32_t follow (CodeBlock& code, uint32_t target, OpCode also);
+
+		static bool is_push (const Instruction& instruction);
+		static bool same_name (const Instruction& left, const Instruction& right);
+	};
+}
@@ -84,6 +84,7 @@ namespace Signal
 			case MINUS_EQUALS: return ("-="); 
 			case TIMES_EQUALS: return ("*="); 
 			case DIVIDE_EQUALS: return ("/="); 
+			case MODULO_EQUALS: return ("%="); 
 			case OR: return ("||"); 
 			case AND: return ("&&"); 
 			case EQUALS_EQUALS: return ("=="); 
@@ -49,6 +49,7 @@ namespace Signal
 			MINUS_EQUALS, 
 			TIMES_EQUALS, 
 			DIVIDE_EQUALS, 
+			MODULO_EQUALS, 
 			OR, 
 			AND, 
 			EQUALS_EQUALS, 
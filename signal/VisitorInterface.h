@@ -21,6 +21,7 @@ namespace Signal
 	class ASTAssignment;
 	class ASTCompare;
 	class ASTBinaryMathOp;
+	class ASTCompoundAssignment;
 	class ASTUnaryMathOp;
 	class ASTNew;
 	class ASTGFuncCall;
@@ -60,6 +61,7 @@ namespace Signal
 		virtual void visit (const ASTAssignment& expr, std::shared_ptr<Function> func) = 0;
 		virtual void visit (const ASTCompare& expr, std::shared_ptr<Function> func) = 0;
 		virtual void visit (const ASTBinaryMathOp& expr, std::shared_ptr<Function> func) = 0;
+		virtual void visit (const ASTCompoundAssignment& expr, std::shared_ptr<Function> func) = 0;
 		virtual void visit (const ASTUnaryMathOp& expr, std::shared_ptr<Function> func) = 0;
 		virtual void visit (const ASTNew& expr, std::shared_ptr<Function> func) = 0;
 		virtual void visit (const ASTGFuncCall& expr, std::shared_ptr<Function> func) = 0;
@@ -2,13 +2,14 @@
 
 #include "Compiler.h"
 #include "Interpreter.h"
+#include "Optimizer.h"
 #include "Parser.h"
 #include "Enviroment.h"
 
 using namespace Signal;
 
 
-std::shared_ptr<Object> printFunc(Environment env, std::vector<std::shared_ptr<Object>> args)
+std::shared_ptr<Object> printFunc(Environment& env, const Arguments& args)
 {
 	if (args.size() != 1)
 		throw Error ("print() : Print takes 1 parameter.");
@@ -31,7 +32,7 @@ int main (int argc, char* argv[])
 			FileInput file (name);
 			Lexer lexer (file);
 			Parser parser (lexer);
-			std::shared_ptr<AST> ast = parser.parse_program ();
+			std::shared_ptr<AST> ast = Optimizer::Optimize (parser.parse_program ());
 			Environment env = Environment ();
 
 			env.exportFunction("print", printFunc);
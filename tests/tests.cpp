@@ -0,0 +1,221 @@
+#include <iostream>
+
+#include "Compiler.h"
+#include "Interpreter.h"
+#include "Optimizer.h"
+#include "Parser.h"
+#include "Enviroment.h"
+
+using namespace Signal;
+
+// Where the test scripts are, the first argument overrides it
+std::string scripts = "scripts/";
+
+// Everything the scripts printed since the last test
+std::string output = "";
+
+// Makes fail () throw
+bool failing = false;
+
+// How often counted () ran, which is bound as pure so the compiler may move it
+uint32_t counted = 0;
+
+
+std::shared_ptr<Object> printFunc(Environment& env, const Arguments& args)
+{
+	if (args.size() != 1)
+		throw Error ("print() : Print takes 1 parameter.");
+	output += args[0]->toString();
+
+	return nullptr;
+}
+
+
+std::shared_ptr<Object> failFunc(Environment& env, const Arguments& args)
+{
+	if (failing)
+		throw Error ("fail() : Failing on purpose.");
+
+	return nullptr;
+}
+
+
+std::shared_ptr<Object> countedFunc(Environment& env, const Arguments& args)
+{
+	return std::shared_ptr<Object> (new Number (counted));
+}
+
+
+void compile (Environment& env, const std::string& name, bool optimize = true)
+{
+	FileInput file (scripts + name);
+	Lexer lexer (file);
+	Parser parser (lexer);
+	std::shared_ptr<AST> ast = parser.parse_program ();
+
+	if (optimize) {
+		ast = Optimizer::Optimize (ast);
+	}
+
+	env.exportFunction("print", printFunc);
+	env.exportFunction("fail", failFunc);
+	env.exportFunction("counted", countedFunc);
+	env.bind<int32_t (int32_t)>("twice", [](int32_t value) { return value * 2; }, true);
+	env.bind<double_t (double_t)>("count", [](double_t value) { counted++; return value; }, true);
+
+	Compiler::Compile(env, ast, optimize);
+}
+
+
+bool check (const std::string& test, const std::string& expect)
+{
+	if (output == expect) {
+		return true;
+	}
+
+	std::cout << test << " : expected '" << expect << "' but got '" << output << "'" << std::endl;
+	return false;
+}
+
+
+// Runs a script with and without optimizing it, an error it throws is part of its output
+bool run_script (const std::string& name, const std::string& expect)
+{
+	bool passed = true;
+
+	for (uint32_t optimize = 0; optimize < 2; optimize++) {
+		output = "";
+		counted = 0;
+
+		try
+		{
+			Environment env = Environment ();
+			compile (env, name, optimize == 1);
+
+			Interpreter interpreter(env);
+			interpreter.execute ();
+		}
+		catch (Error& error)
+		{
+			output += "Error: " + error.getError();
+		}
+
+		passed = check (optimize ? name : name + " (unoptimized)", expect) && passed;
+	}
+
+	return passed;
+}
+
+
+// An execute () after an error starts main () again instead of carrying on from the error
+bool execute_after_error ()
+{
+	Environment env = Environment ();
+	compile (env, "execute_after_error.sig");
+	Interpreter interpreter(env);
+
+	output = "";
+	failing = true;
+
+	try
+	{
+		interpreter.execute ();
+		output += "no error";
+	}
+	catch (Error&)
+	{
+	}
+
+	failing = false;
+	interpreter.execute ();
+
+	return check ("execute_after_error", "<<>");
+}
+
+
+// Running a script again on the same interpreter doesn't leave anything on the stack, or it would overflow
+bool execute_again ()
+{
+	Environment env = Environment ();
+	compile (env, "execute_again.sig");
+	Interpreter interpreter(env);
+
+	interpreter.set_limits (4, 8);
+	output = "";
+
+	for (uint32_t i = 0; i < 20; i++) {
+		interpreter.execute ();
+	}
+
+	return check ("execute_again", std::string (20, '1'));
+}
+
+
+// Numbers passed as an int32_t have to be whole and in range
+bool marshal_int ()
+{
+	const double_t bad[] = { 2.7, -0.5, 2147483648.0, -2147483649.0, std::numeric_limits<double_t>::infinity (), std::numeric_limits<double_t>::quiet_NaN () };
+	bool passed = true;
+
+	for (uint32_t i = 0; i < sizeof (bad) / sizeof (bad[0]); i++) {
+		try
+		{
+			Marshal<int32_t>::from (std::shared_ptr<Object> (new Number (bad[i])));
+			std::cout << "marshal_int : " << bad[i] << " was accepted" << std::endl;
+			passed = false;
+		}
+		catch (Error&)
+		{
+		}
+	}
+
+	if (Marshal<int32_t>::from (std::shared_ptr<Object> (new Number (-2147483648.0))) != std::numeric_limits<int32_t>::min () ||
+		Marshal<int32_t>::from (std::shared_ptr<Object> (new Number (2147483647.0))) != std::numeric_limits<int32_t>::max ()) {
+		std::cout << "marshal_int : the ends of the range were not converted" << std::endl;
+		passed = false;
+	}
+
+	return passed;
+}
+
+
+int main (int argc, char* argv[])
+{
+	if (argc == 2) {
+		scripts = argv[1];
+	}
+
+	uint32_t failed = 0;
+
+	failed += !run_script ("peephole.sig", "44 onefewfewmany 27 true2false 5falsefalse 302");
+	failed += !run_script ("dead_code.sig", "f542-1!");
+	failed += !run_script ("nested_jumps.sig", "001003||021023");
+	failed += !run_script ("tail_calls.sig", "25000 falsetrue");
+	failed += !run_script ("switch_table.sig", "zerosmallsmallotherfourfiveafterotherotherother ABCCD.1357");
+	failed += !run_script ("inline_locals.sig", "335 3211 -+-+");
+	failed += !run_script ("number_operands.sig", "3xyxyxy2aa 2ssssabab true3 4Error: Interpreter : Invalid arguments to operator '+'.");
+	failed += !run_script ("if_else.sig", "one two many then");
+	failed += !run_script ("for_string_bound.sig", "012 | 0123 | 210");
+	failed += !run_script ("logical_operands.sig", "falsetrue falsetrue 1x Error: Interpreter : Invalid arguments to operator '&&'.");
+	failed += !run_script ("compound_alias.sig", "21 -41 21 31");
+	failed += !run_script ("inherited_member.sig", "2 Error: Scope : Variable 'x' has not been defined.");
+	failed += !run_script ("hoist_conditional.sig", "done 0 2");
+	failed += !run_script ("hoist_int_argument.sig", "aError: Marshal : Expected a whole number that fits in 32 bits, got 2.5.");
+	failed += !run_script ("int_argument.sig", "42 Error: Marshal : Expected a whole number that fits in 32 bits, got 2.7.");
+	failed += !marshal_int ();
+
+	try
+	{
+		failed += !execute_after_error ();
+		failed += !execute_again ();
+	}
+	catch (Error& error)
+	{
+		std::cout << error.getError() << std::endl;
+		failed++;
+	}
+
+	std::cout << failed << " tests failed." << std::endl;
+
+	return failed == 0 ? 0 : 1;
+}
\ No newline at end of file